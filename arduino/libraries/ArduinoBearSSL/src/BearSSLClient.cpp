@@ -48,8 +48,11 @@ BearSSLClient::BearSSLClient(Client* client, const br_x509_trust_anchor* myTAs,
   _client(client),
   _TAs(myTAs),
   _numTAs(myNumTAs),
-  _noSNI(false)
+  _noSNI(false),
+  _sessionValid(false)
 {
+  _sessionKey[0] = '\0';
+
   _ecKey.curve = 0;
   _ecKey.x = NULL;
   _ecKey.xlen = 0;
@@ -73,7 +76,10 @@ int BearSSLClient::connect(IPAddress ip, uint16_t port)
     return 0;
   }
 
-  return connectSSL(NULL);
+  char sessionKey[sizeof(_sessionKey)];
+  snprintf(sessionKey, sizeof(sessionKey), "%d.%d.%d.%d:%d", ip[0], ip[1], ip[2], ip[3], port);
+
+  return connectSSL(NULL, sessionKey);
 }
 
 int BearSSLClient::connect(const char* host, uint16_t port)
@@ -82,7 +88,10 @@ int BearSSLClient::connect(const char* host, uint16_t port)
     return 0;
   }
 
-  return connectSSL(_noSNI ? NULL : host);
+  char sessionKey[sizeof(_sessionKey)];
+  snprintf(sessionKey, sizeof(sessionKey), "%s:%d", host, port);
+
+  return connectSSL(_noSNI ? NULL : host, sessionKey);
 }
 
 size_t BearSSLClient::write(uint8_t b)
@@ -264,7 +273,7 @@ int BearSSLClient::errorCode()
   return br_ssl_engine_last_error(&_sc.eng);
 }
 
-int BearSSLClient::connectSSL(const char* host)
+int BearSSLClient::connectSSL(const char* host, const char* sessionKey)
 {
   // initialize client context with all algorithms and hardcoded trust anchors
   br_ssl_client_init_full(&_sc, &_xc, _TAs, _numTAs);
@@ -295,8 +304,17 @@ int BearSSLClient::connectSSL(const char* host)
   }
   br_ssl_engine_inject_entropy(&_sc.eng, entropy, sizeof(entropy));
 
+  // resume the previous session when reconnecting to the same server, this
+  // skips the key exchange and the client certificate signature
+  int resume = 0;
+
+  if (_sessionValid && strcmp(_sessionKey, sessionKey) == 0) {
+    br_ssl_engine_set_session_parameters(&_sc.eng, &_sessionParams);
+    resume = 1;
+  }
+
   // set the hostname used for SNI
-  br_ssl_client_reset(&_sc, host, 0);
+  br_ssl_client_reset(&_sc, host, resume);
 
   // get the current time and set it for X.509 validation
   uint32_t now = ArduinoBearSSL.getTime();
@@ -318,10 +336,16 @@ int BearSSLClient::connectSSL(const char* host)
     if (state & BR_SSL_SENDAPP) {
       break;
     } else if (state & BR_SSL_CLOSED) {
+      _sessionValid = false;
       return 0;
     }
   }
 
+  br_ssl_engine_get_session_parameters(&_sc.eng, &_sessionParams);
+  strncpy(_sessionKey, sessionKey, sizeof(_sessionKey) - 1);
+  _sessionKey[sizeof(_sessionKey) - 1] = '\0';
+  _sessionValid = true;
+
   return 1;
 }
 
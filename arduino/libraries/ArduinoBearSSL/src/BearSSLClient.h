@@ -78,7 +78,7 @@ public:
   int errorCode();
 
 private:
-  int connectSSL(const char* host);
+  int connectSSL(const char* host, const char* sessionKey);
   static int clientRead(void *ctx, unsigned char *buf, size_t len);
   static int clientWrite(void *ctx, const unsigned char *buf, size_t len);
   static void clientAppendCert(void *ctx, const void *data, size_t len);
@@ -99,6 +99,12 @@ private:
   unsigned char _ibuf[BEAR_SSL_CLIENT_IBUF_SIZE];
   unsigned char _obuf[BEAR_SSL_CLIENT_OBUF_SIZE];
   br_sslio_context _ioc;
+
+  // parameters of the last session, resumed when reconnecting to the same
+  // server (sessionKey is "host:port")
+  br_ssl_session_parameters _sessionParams;
+  bool _sessionValid;
+  char _sessionKey[64 + 7];
 };
 
 #endif
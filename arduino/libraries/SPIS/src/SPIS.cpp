@@ -34,7 +34,8 @@ SPISClass::SPISClass(spi_host_device_t hostDevice, int dmaChannel, int mosiPin,
   _misoPin(misoPin),
   _sclkPin(sclkPin),
   _csPin(csPin),
-  _readyPin(readyPin)
+  _readyPin(readyPin),
+  _queuedTransIndex(0)
 {
 }
 
@@ -58,10 +59,10 @@ int SPISClass::begin()
   memset(&slvCfg, 0x00, sizeof(slvCfg));
   slvCfg.mode = 0;
   slvCfg.spics_io_num = _csPin;
-  slvCfg.queue_size = 1;
+  slvCfg.queue_size = 2;
   slvCfg.flags = 0;
   slvCfg.post_setup_cb = SPISClass::onSetupComplete;
-  slvCfg.post_trans_cb = NULL;
+  slvCfg.post_trans_cb = SPISClass::onTransferComplete;
 
   gpio_set_pull_mode((gpio_num_t)_mosiPin, GPIO_FLOATING);
   gpio_set_pull_mode((gpio_num_t)_sclkPin, GPIO_PULLDOWN_ONLY);
@@ -93,6 +94,39 @@ int SPISClass::transfer(uint8_t out[], uint8_t in[], size_t len)
   return (slvTrans.trans_len / 8);
 }
 
+int SPISClass::queue(uint8_t out[], uint8_t in[], size_t len)
+{
+  // two slots are enough: at most a response and the next receive are in flight
+  spi_slave_transaction_t* slvTrans = &_queuedTrans[_queuedTransIndex];
+
+  _queuedTransIndex = (_queuedTransIndex + 1) % 2;
+
+  memset(slvTrans, 0x00, sizeof(*slvTrans));
+
+  slvTrans->length = len * 8;
+  slvTrans->trans_len = 0;
+  slvTrans->tx_buffer = out;
+  slvTrans->rx_buffer = in;
+  slvTrans->user = this; // READY is handled by the driver callbacks
+
+  if (spi_slave_queue_trans(_hostDevice, slvTrans, portMAX_DELAY) != ESP_OK) {
+    return 0;
+  }
+
+  return 1;
+}
+
+int SPISClass::wait()
+{
+  spi_slave_transaction_t* slvRetTrans;
+
+  if (spi_slave_get_trans_result(_hostDevice, &slvRetTrans, portMAX_DELAY) != ESP_OK) {
+    return 0;
+  }
+
+  return (slvRetTrans->trans_len / 8);
+}
+
 void SPISClass::onChipSelect()
 {
   SPIS.handleOnChipSelect();
@@ -103,14 +137,30 @@ void SPISClass::handleOnChipSelect()
   digitalWrite(_readyPin, HIGH);
 }
 
-void SPISClass::onSetupComplete(spi_slave_transaction_t*)
+void SPISClass::onSetupComplete(spi_slave_transaction_t* slvTrans)
+{
+  SPIS.handleSetupComplete(slvTrans);
+}
+
+void SPISClass::handleSetupComplete(spi_slave_transaction_t* slvTrans)
+{
+  if (slvTrans->user) {
+    digitalWrite(_readyPin, LOW);
+  } else {
+    xSemaphoreGiveFromISR(_readySemaphore, NULL);
+  }
+}
+
+void SPISClass::onTransferComplete(spi_slave_transaction_t* slvTrans)
 {
-  SPIS.handleSetupComplete();
+  SPIS.handleTransferComplete(slvTrans);
 }
 
-void SPISClass::handleSetupComplete()
+void SPISClass::handleTransferComplete(spi_slave_transaction_t* slvTrans)
 {
-  xSemaphoreGiveFromISR(_readySemaphore, NULL);
+  if (slvTrans->user) {
+    digitalWrite(_readyPin, HIGH);
+  }
 }
 
 SPISClass SPIS(VSPI_HOST, 1, 12, 23, 18, 5, 33);
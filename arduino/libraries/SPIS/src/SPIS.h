@@ -31,12 +31,21 @@ class SPISClass {
     int begin();
     int transfer(uint8_t out[], uint8_t in[], size_t len);
 
+    // pipelined transport: transactions are queued without waiting and the
+    // READY pin is driven from the driver callbacks, so a receive queued
+    // behind a response is armed as soon as the response has been clocked out
+    int queue(uint8_t out[], uint8_t in[], size_t len);
+    int wait();
+
   private:
     static void onChipSelect();
     void handleOnChipSelect();
 
     static void onSetupComplete(spi_slave_transaction_t*);
-    void handleSetupComplete();
+    void handleSetupComplete(spi_slave_transaction_t*);
+
+    static void onTransferComplete(spi_slave_transaction_t*);
+    void handleTransferComplete(spi_slave_transaction_t*);
 
   private:
     spi_host_device_t _hostDevice;
@@ -50,6 +59,9 @@ class SPISClass {
     intr_handle_t _csIntrHandle;
 
     SemaphoreHandle_t _readySemaphore;
+
+    spi_slave_transaction_t _queuedTrans[2];
+    int _queuedTransIndex;
 };
 
 extern SPISClass SPIS;
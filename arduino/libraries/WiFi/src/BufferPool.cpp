@@ -0,0 +1,73 @@
+/*
+  This file is part of the Arduino NINA firmware.
+  Copyright (c) 2018 Arduino SA. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "BufferPool.h"
+
+BufferPool::BufferPool(size_t blockSize, int maxCached, uint32_t caps) :
+  _blockSize(blockSize),
+  _maxCached(maxCached),
+  _caps(caps),
+  _cached(NULL),
+  _cachedCount(0)
+{
+  _mutex = xSemaphoreCreateMutex();
+}
+
+void* BufferPool::alloc()
+{
+  void* block = NULL;
+
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+
+  if (_cached != NULL) {
+    block = _cached;
+    _cached = *(void**)block;
+    _cachedCount--;
+  }
+
+  xSemaphoreGive(_mutex);
+
+  if (block == NULL) {
+    block = heap_caps_malloc(_blockSize, _caps);
+  }
+
+  return block;
+}
+
+void BufferPool::release(void* block)
+{
+  if (block == NULL) {
+    return;
+  }
+
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+
+  if (_cachedCount < _maxCached) {
+    *(void**)block = _cached;
+    _cached = block;
+    _cachedCount++;
+    block = NULL;
+  }
+
+  xSemaphoreGive(_mutex);
+
+  if (block != NULL) {
+    heap_caps_free(block);
+  }
+}
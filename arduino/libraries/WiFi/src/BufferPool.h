@@ -0,0 +1,55 @@
+/*
+  This file is part of the Arduino NINA firmware.
+  Copyright (c) 2018 Arduino SA. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <esp_heap_caps.h>
+
+// Fixed size blocks for socket I/O buffers, shared by all the sockets of a
+// kind. Blocks are taken from the heap when needed, up to maxCached of the
+// released ones are kept for the next connection and the others go back to
+// the heap, so buffers only hold memory while their socket is in use.
+class BufferPool {
+public:
+  BufferPool(size_t blockSize, int maxCached, uint32_t caps = MALLOC_CAP_8BIT);
+
+  void* alloc();
+  void release(void* block);
+
+  size_t blockSize() const { return _blockSize; }
+
+private:
+  size_t _blockSize;
+  int _maxCached;
+  uint32_t _caps;
+
+  void* _cached; // released blocks, each one starts with the next pointer
+  int _cachedCount;
+
+  SemaphoreHandle_t _mutex;
+};
+
+#endif // BUFFER_POOL_H
@@ -198,6 +198,11 @@ bool WiFiClient::operator==(const WiFiClient &other) const
   return (_socket == other._socket);
 }
 
+int WiFiClient::fd() const
+{
+  return _socket;
+}
+
 /*IPAddress*/uint32_t WiFiClient::remoteIP()
 {
   struct sockaddr_storage addr;
@@ -50,6 +50,8 @@ public:
   virtual /*IPAddress*/uint32_t remoteIP();
   virtual uint16_t remotePort();
 
+  int fd() const;
+
   // using Print::write;
 
 protected:
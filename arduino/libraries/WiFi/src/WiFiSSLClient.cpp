@@ -21,6 +21,9 @@
 #include <lwip/sockets.h>
 #include "esp_partition.h"
 
+#include <mbedtls/md.h>
+#include <mbedtls/pk.h>
+
 #include "WiFiSSLClient.h"
 
 class __Guard {
@@ -41,13 +44,336 @@ private:
 
 #define synchronized __Guard __guard(_mbedMutex);
 
+mbedtls_x509_crt WiFiSSLClient::_trustStore;
+bool WiFiSSLClient::_trustStoreParsed = false;
+SemaphoreHandle_t WiFiSSLClient::_trustStoreMutex = NULL;
+const uint8_t* WiFiSSLClient::_bundle = NULL;
+BufferPool WiFiSSLClient::_contextsPool(sizeof(WiFiSSLClient::Contexts), 1);
+
+// indexed certificate bundle created by tools/crt_bundle.py
+#define BUNDLE_MAGIC "NCB2"
+#define BUNDLE_HEADER_LEN 6
+#define BUNDLE_INDEX_ENTRY_LEN 8
+#define BUNDLE_TIME_LEN 7
+#define BUNDLE_RECORD_HEADER_LEN (4 + 2 * BUNDLE_TIME_LEN)
+
+static uint16_t bundleRead16(const uint8_t* p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+static uint32_t bundleRead32(const uint8_t* p)
+{
+  return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void bundleReadTime(const uint8_t* p, mbedtls_x509_time* time)
+{
+  time->year = bundleRead16(&p[0]);
+  time->mon = p[2];
+  time->day = p[3];
+  time->hour = p[4];
+  time->min = p[5];
+  time->sec = p[6];
+}
+
+static uint32_t bundleHash(const uint8_t* data, size_t len)
+{
+  // FNV-1a
+  uint32_t hash = 0x811c9dc5;
+
+  while (len--) {
+    hash ^= *data++;
+    hash *= 0x01000193;
+  }
+
+  return hash;
+}
+
+// sessions of the last hosts connected to, reused to skip the full handshake
+// when reconnecting to the same host and port
+#define SESSION_CACHE_SIZE 4
+
+struct SessionCacheEntry {
+  char host[64];
+  uint16_t port;
+  uint32_t lastUsed;
+  mbedtls_ssl_session session;
+};
+
+static SessionCacheEntry sessionCache[SESSION_CACHE_SIZE];
+static uint32_t sessionCacheCounter = 0;
+static SemaphoreHandle_t sessionCacheMutex = NULL;
+
+static SessionCacheEntry* sessionCacheFind(const char* host, uint16_t port)
+{
+  for (int i = 0; i < SESSION_CACHE_SIZE; i++) {
+    if (sessionCache[i].lastUsed != 0 && sessionCache[i].port == port && strcmp(sessionCache[i].host, host) == 0) {
+      return &sessionCache[i];
+    }
+  }
+
+  return NULL;
+}
+
+static void sessionCacheLoad(mbedtls_ssl_context* ssl, const char* host, uint16_t port)
+{
+  __Guard __guard(sessionCacheMutex);
+
+  SessionCacheEntry* entry = sessionCacheFind(host, port);
+
+  if (entry != NULL) {
+    // the session is copied into the context
+    mbedtls_ssl_set_session(ssl, &entry->session);
+
+    entry->lastUsed = ++sessionCacheCounter;
+  }
+}
+
+static void sessionCacheStore(const mbedtls_ssl_context* ssl, const char* host, uint16_t port)
+{
+  if (strlen(host) >= sizeof(sessionCache[0].host)) {
+    return;
+  }
+
+  __Guard __guard(sessionCacheMutex);
+
+  SessionCacheEntry* entry = sessionCacheFind(host, port);
+
+  if (entry == NULL) {
+    // unused or least recently used entry
+    entry = &sessionCache[0];
+
+    for (int i = 1; i < SESSION_CACHE_SIZE; i++) {
+      if (sessionCache[i].lastUsed < entry->lastUsed) {
+        entry = &sessionCache[i];
+      }
+    }
+  }
+
+  if (entry->lastUsed != 0) {
+    mbedtls_ssl_session_free(&entry->session);
+  }
+
+  mbedtls_ssl_session_init(&entry->session);
+
+  if (mbedtls_ssl_get_session(ssl, &entry->session) != 0) {
+    mbedtls_ssl_session_free(&entry->session);
+    entry->lastUsed = 0;
+    return;
+  }
+
+  strcpy(entry->host, host);
+  entry->port = port;
+  entry->lastUsed = ++sessionCacheCounter;
+}
+
+static void sessionCacheRemove(const char* host, uint16_t port)
+{
+  __Guard __guard(sessionCacheMutex);
+
+  SessionCacheEntry* entry = sessionCacheFind(host, port);
+
+  if (entry != NULL) {
+    mbedtls_ssl_session_free(&entry->session);
+    entry->lastUsed = 0;
+  }
+}
+
+// same rules as mbedTLS applies to the keys of the certificates it verifies
+static bool keyAllowed(const mbedtls_x509_crt_profile* profile, const mbedtls_pk_context* pk)
+{
+  mbedtls_pk_type_t type = mbedtls_pk_get_type(pk);
+
+  if (type == MBEDTLS_PK_RSA || type == MBEDTLS_PK_RSASSA_PSS) {
+    return (mbedtls_pk_get_bitlen(pk) >= profile->rsa_min_bitlen);
+  }
+
+  if (type == MBEDTLS_PK_ECDSA || type == MBEDTLS_PK_ECKEY || type == MBEDTLS_PK_ECKEY_DH) {
+    mbedtls_ecp_group_id id = mbedtls_pk_ec(*pk)->grp.id;
+
+    return (id != MBEDTLS_ECP_DP_NONE && (profile->allowed_curves & MBEDTLS_X509_ID_FLAG(id)) != 0);
+  }
+
+  return false;
+}
+
+// returns 0 when the key signed child, a key the profile doesn't allow
+// sets MBEDTLS_X509_BADCERT_BAD_KEY in flags
+static int checkSignature(const mbedtls_x509_crt* child, const uint8_t* key, size_t keyLen, const mbedtls_x509_crt_profile* profile, uint32_t* flags)
+{
+  unsigned char hash[MBEDTLS_MD_MAX_SIZE];
+  mbedtls_pk_context pk;
+
+  const mbedtls_md_info_t* mdInfo = mbedtls_md_info_from_type(child->sig_md);
+  if (mdInfo == NULL) {
+    return -1;
+  }
+
+  mbedtls_pk_init(&pk);
+
+  int ret = mbedtls_pk_parse_public_key(&pk, key, keyLen);
+
+  if (ret == 0 && !keyAllowed(profile, &pk)) {
+    *flags |= MBEDTLS_X509_BADCERT_BAD_KEY;
+  }
+
+  if (ret == 0) {
+    ret = mbedtls_md(mdInfo, child->tbs.p, child->tbs.len, hash);
+  }
+
+  if (ret == 0) {
+    ret = mbedtls_pk_verify_ext(child->sig_pk, child->sig_opts, &pk, child->sig_md, hash, mbedtls_md_get_size(mdInfo), child->sig.p, child->sig.len);
+  }
+
+  mbedtls_pk_free(&pk);
+
+  return ret;
+}
+
 WiFiSSLClient::WiFiSSLClient() :
+  _contexts(NULL),
   _connected(false),
   _peek(-1)
 {
   _netContext.fd = -1;
 
   _mbedMutex = xSemaphoreCreateRecursiveMutex();
+
+  if (_trustStoreMutex == NULL) {
+    _trustStoreMutex = xSemaphoreCreateRecursiveMutex();
+  }
+
+  if (sessionCacheMutex == NULL) {
+    sessionCacheMutex = xSemaphoreCreateRecursiveMutex();
+  }
+}
+
+WiFiSSLClient::~WiFiSSLClient()
+{
+  stop();
+
+  vSemaphoreDelete(_mbedMutex);
+}
+
+mbedtls_x509_crt* WiFiSSLClient::trustStore()
+{
+  __Guard __guard(_trustStoreMutex);
+
+  if (_trustStoreParsed) {
+    return &_trustStore;
+  }
+
+  spi_flash_mmap_handle_t handle;
+  const unsigned char* certs_data = {};
+
+  const esp_partition_t* part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "certs");
+  if (part == NULL)
+  {
+    return NULL;
+  }
+
+  int ret = esp_partition_mmap(part, 0, part->size, SPI_FLASH_MMAP_DATA, (const void**)&certs_data, &handle);
+  if (ret != ESP_OK)
+  {
+    return NULL;
+  }
+
+  mbedtls_x509_crt_init(&_trustStore);
+
+  if (memcmp(certs_data, BUNDLE_MAGIC, strlen(BUNDLE_MAGIC)) == 0) {
+    // keep the mapping, issuers are looked up in place by verifyBundle(),
+    // mbedTLS still needs a (here empty) CA chain to be configured
+    _bundle = certs_data;
+    _trustStoreParsed = true;
+
+    return &_trustStore;
+  }
+
+  ret = mbedtls_x509_crt_parse(&_trustStore, certs_data, strlen((char*)certs_data) + 1);
+
+  // the parsed certificates are copies, the mapping is no longer needed
+  spi_flash_munmap(handle);
+
+  if (ret < 0) {
+    mbedtls_x509_crt_free(&_trustStore);
+    return NULL;
+  }
+
+  // kept for the lifetime of the firmware, so reconnecting doesn't parse
+  // the whole bundle again
+  _trustStoreParsed = true;
+
+  return &_trustStore;
+}
+
+int WiFiSSLClient::verifyBundle(void* ctx, mbedtls_x509_crt* crt, int depth, uint32_t* flags)
+{
+  Contexts* contexts = (Contexts*)ctx;
+
+  // mbedTLS calls this from the top of the chain down, only the top, whose
+  // issuer is not in the empty CA chain, is checked against the bundle
+  if (contexts->verifyTop < 0) {
+    contexts->verifyTop = depth;
+  }
+
+  if (depth != contexts->verifyTop || (*flags & MBEDTLS_X509_BADCERT_NOT_TRUSTED) == 0) {
+    return 0;
+  }
+
+  uint32_t hash = bundleHash(crt->issuer_raw.p, crt->issuer_raw.len);
+  int count = bundleRead16(&_bundle[4]);
+  const uint8_t* index = &_bundle[BUNDLE_HEADER_LEN];
+  int low = 0;
+  int high = count;
+
+  // first index entry with this hash
+  while (low < high) {
+    int mid = (low + high) / 2;
+
+    if (bundleRead32(&index[mid * BUNDLE_INDEX_ENTRY_LEN]) < hash) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  for (int i = low; i < count && bundleRead32(&index[i * BUNDLE_INDEX_ENTRY_LEN]) == hash; i++) {
+    const uint8_t* record = &_bundle[bundleRead32(&index[i * BUNDLE_INDEX_ENTRY_LEN + 4])];
+    size_t subjectLen = bundleRead16(&record[0]);
+    size_t keyLen = bundleRead16(&record[2]);
+    const uint8_t* subject = &record[BUNDLE_RECORD_HEADER_LEN];
+    const uint8_t* key = &subject[subjectLen];
+    uint32_t rootFlags = 0;
+
+    if (subjectLen != crt->issuer_raw.len || memcmp(subject, crt->issuer_raw.p, subjectLen) != 0 ||
+        checkSignature(crt, key, keyLen, contexts->sslConfig.cert_profile, &rootFlags) != 0) {
+      continue;
+    }
+
+    // the root is held to the same rules as a CA chain certificate, the
+    // times are only checked when mbedTLS is built with MBEDTLS_HAVE_TIME_DATE
+    mbedtls_x509_time validFrom;
+    mbedtls_x509_time validTo;
+
+    bundleReadTime(&record[4], &validFrom);
+    bundleReadTime(&record[4 + BUNDLE_TIME_LEN], &validTo);
+
+    if (mbedtls_x509_time_is_future(&validFrom)) {
+      rootFlags |= MBEDTLS_X509_BADCERT_FUTURE;
+    }
+    if (mbedtls_x509_time_is_past(&validTo)) {
+      rootFlags |= MBEDTLS_X509_BADCERT_EXPIRED;
+    }
+
+    // anything else the profile found wrong with the certificate (expired,
+    // weak hash, ...) still fails the handshake
+    *flags &= ~MBEDTLS_X509_BADCERT_NOT_TRUSTED;
+    *flags |= rootFlags;
+    break;
+  }
+
+  return 0;
 }
 
 int WiFiSSLClient::connect(const char* host, uint16_t port, bool sni)
@@ -56,56 +382,53 @@ int WiFiSSLClient::connect(const char* host, uint16_t port, bool sni)
     _netContext.fd = -1;
     _connected = false;
 
-    mbedtls_ssl_init(&_sslContext);
-    mbedtls_ctr_drbg_init(&_ctrDrbgContext);
-    mbedtls_ssl_config_init(&_sslConfig);
-    mbedtls_entropy_init(&_entropyContext);
-    mbedtls_x509_crt_init(&_caCrt);
+    if (_contexts == NULL) {
+      _contexts = (Contexts*)_contextsPool.alloc();
+
+      if (_contexts == NULL) {
+        return 0;
+      }
+    }
+
+    mbedtls_ssl_init(&_contexts->sslContext);
+    mbedtls_ctr_drbg_init(&_contexts->ctrDrbgContext);
+    mbedtls_ssl_config_init(&_contexts->sslConfig);
+    mbedtls_entropy_init(&_contexts->entropyContext);
     mbedtls_net_init(&_netContext);
 
-    if (mbedtls_ctr_drbg_seed(&_ctrDrbgContext, mbedtls_entropy_func, &_entropyContext, NULL, 0) != 0) {
+    if (mbedtls_ctr_drbg_seed(&_contexts->ctrDrbgContext, mbedtls_entropy_func, &_contexts->entropyContext, NULL, 0) != 0) {
       stop();
       return 0;
     }
 
-    if (mbedtls_ssl_config_defaults(&_sslConfig, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+    if (mbedtls_ssl_config_defaults(&_contexts->sslConfig, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
       stop();
       return 0;
     }
 
-    mbedtls_ssl_conf_authmode(&_sslConfig, MBEDTLS_SSL_VERIFY_REQUIRED);
-
-    spi_flash_mmap_handle_t handle;
-    const unsigned char* certs_data = {};
+    mbedtls_ssl_conf_authmode(&_contexts->sslConfig, MBEDTLS_SSL_VERIFY_REQUIRED);
 
-    const esp_partition_t* part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "certs");
-    if (part == NULL)
-    {
+    mbedtls_x509_crt* caCrt = trustStore();
+    if (caCrt == NULL) {
+      stop();
       return 0;
     }
 
-    int ret = esp_partition_mmap(part, 0, part->size, SPI_FLASH_MMAP_DATA, (const void**)&certs_data, &handle);
-    if (ret != ESP_OK)
-    {
-      return 0;
-    }
+    mbedtls_ssl_conf_ca_chain(&_contexts->sslConfig, caCrt, NULL);
 
-    ret = mbedtls_x509_crt_parse(&_caCrt, certs_data, strlen((char*)certs_data) + 1);
-    if (ret < 0) {
-      stop();
-      return 0;
+    if (_bundle != NULL) {
+      _contexts->verifyTop = -1;
+      mbedtls_ssl_conf_verify(&_contexts->sslConfig, verifyBundle, _contexts);
     }
 
-    mbedtls_ssl_conf_ca_chain(&_sslConfig, &_caCrt, NULL);
-
-    mbedtls_ssl_conf_rng(&_sslConfig, mbedtls_ctr_drbg_random, &_ctrDrbgContext);
+    mbedtls_ssl_conf_rng(&_contexts->sslConfig, mbedtls_ctr_drbg_random, &_contexts->ctrDrbgContext);
 
-    if (mbedtls_ssl_setup(&_sslContext, &_sslConfig) != 0) {
+    if (mbedtls_ssl_setup(&_contexts->sslContext, &_contexts->sslConfig) != 0) {
       stop();
       return 0;
     }
 
-    if (sni && mbedtls_ssl_set_hostname(&_sslContext, host) != 0) {
+    if (sni && mbedtls_ssl_set_hostname(&_contexts->sslContext, host) != 0) {
       stop();
       return 0;
     }
@@ -118,19 +441,26 @@ int WiFiSSLClient::connect(const char* host, uint16_t port, bool sni)
       return 0;
     }
 
-    mbedtls_ssl_set_bio(&_sslContext, &_netContext, mbedtls_net_send, mbedtls_net_recv, NULL);
+    mbedtls_ssl_set_bio(&_contexts->sslContext, &_netContext, mbedtls_net_send, mbedtls_net_recv, NULL);
+
+    sessionCacheLoad(&_contexts->sslContext, host, port);
 
     int result;
 
     do {
-      result = mbedtls_ssl_handshake(&_sslContext);
+      result = mbedtls_ssl_handshake(&_contexts->sslContext);
     } while (result == MBEDTLS_ERR_SSL_WANT_READ || result == MBEDTLS_ERR_SSL_WANT_WRITE);
 
     if (result != 0) {
+      // don't offer the same session again, the next attempt does a full
+      // handshake
+      sessionCacheRemove(host, port);
       stop();
       return 0;
     }
 
+    sessionCacheStore(&_contexts->sslContext, host, port);
+
     mbedtls_net_set_nonblock(&_netContext);
     _connected = true;
 
@@ -160,7 +490,11 @@ size_t WiFiSSLClient::write(uint8_t b)
 size_t WiFiSSLClient::write(const uint8_t *buf, size_t size)
 {
   synchronized {
-    int written = mbedtls_ssl_write(&_sslContext, buf, size);
+    if (_contexts == NULL) {
+      return 0;
+    }
+
+    int written = mbedtls_ssl_write(&_contexts->sslContext, buf, size);
 
     if (written < 0) {
       written = 0;
@@ -173,9 +507,13 @@ size_t WiFiSSLClient::write(const uint8_t *buf, size_t size)
 int WiFiSSLClient::available()
 {
   synchronized {
-    int result = mbedtls_ssl_read(&_sslContext, NULL, 0);
+    if (_contexts == NULL) {
+      return 0;
+    }
 
-    int n = mbedtls_ssl_get_bytes_avail(&_sslContext);
+    int result = mbedtls_ssl_read(&_contexts->sslContext, NULL, 0);
+
+    int n = mbedtls_ssl_get_bytes_avail(&_contexts->sslContext);
 
     if (n == 0 && result != 0 && result != MBEDTLS_ERR_SSL_WANT_READ) {
       stop();
@@ -185,6 +523,17 @@ int WiFiSSLClient::available()
   }
 }
 
+int WiFiSSLClient::buffered()
+{
+  synchronized {
+    if (_contexts == NULL) {
+      return 0;
+    }
+
+    return mbedtls_ssl_get_bytes_avail(&_contexts->sslContext);
+  }
+}
+
 int WiFiSSLClient::read()
 {
   uint8_t b;
@@ -206,7 +555,7 @@ int WiFiSSLClient::read(uint8_t* buf, size_t size)
       return -1;
     }
 
-    int result = mbedtls_ssl_read(&_sslContext, buf, size);
+    int result = mbedtls_ssl_read(&_contexts->sslContext, buf, size);
 
     if (result < 0) {
       if (result != MBEDTLS_ERR_SSL_WANT_READ && result != MBEDTLS_ERR_SSL_WANT_WRITE) {
@@ -237,14 +586,20 @@ void WiFiSSLClient::stop()
 {
   synchronized {
     if (_netContext.fd > 0) {
-      mbedtls_ssl_session_reset(&_sslContext);    
+      mbedtls_ssl_session_reset(&_contexts->sslContext);    
 
       mbedtls_net_free(&_netContext);
-      mbedtls_x509_crt_free(&_caCrt);
-      mbedtls_entropy_free(&_entropyContext);
-      mbedtls_ssl_config_free(&_sslConfig);
-      mbedtls_ctr_drbg_free(&_ctrDrbgContext);
-      mbedtls_ssl_free(&_sslContext);
+    }
+
+    // also after a failed connect, the contexts go back to the pool
+    if (_contexts != NULL) {
+      mbedtls_entropy_free(&_contexts->entropyContext);
+      mbedtls_ssl_config_free(&_contexts->sslConfig);
+      mbedtls_ctr_drbg_free(&_contexts->ctrDrbgContext);
+      mbedtls_ssl_free(&_contexts->sslContext);
+
+      _contextsPool.release(_contexts);
+      _contexts = NULL;
     }
 
     _connected = false;
@@ -274,6 +629,11 @@ WiFiSSLClient::operator bool()
   return ((_netContext.fd != -1) && _connected);
 }
 
+int WiFiSSLClient::fd() const
+{
+  return _netContext.fd;
+}
+
 /*IPAddress*/uint32_t WiFiSSLClient::remoteIP()
 {
   struct sockaddr_storage addr;
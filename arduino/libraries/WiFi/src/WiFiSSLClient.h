@@ -28,12 +28,15 @@
 
 #include <Arduino.h>
 // #include <Client.h>
+
+#include "BufferPool.h"
 // #include <IPAddress.h>
 
 class WiFiSSLClient /*: public Client*/ {
 
 public:
   WiFiSSLClient();
+  ~WiFiSSLClient();
 
   uint8_t status();
 
@@ -55,18 +58,43 @@ public:
   virtual /*IPAddress*/uint32_t remoteIP();
   virtual uint16_t remotePort();
 
+  int fd() const;
+
+  // decrypted bytes already read from the socket, unlike available() it
+  // doesn't read from the socket
+  int buffered();
+
 private:
   int connect(const char* host, uint16_t port, bool sni);
 
+  static mbedtls_x509_crt* trustStore();
+  static int verifyBundle(void* ctx, mbedtls_x509_crt* crt, int depth, uint32_t* flags);
+
 private:
   static const char* ROOT_CAs;
 
-  mbedtls_entropy_context _entropyContext;
-  mbedtls_ctr_drbg_context _ctrDrbgContext;
-  mbedtls_ssl_context _sslContext;
-  mbedtls_ssl_config _sslConfig;
+  // CA certificates from the certs partition, parsed on first use and shared
+  // by all instances. When the partition holds an indexed bundle it is read
+  // in place instead, and the trust store is left empty.
+  static mbedtls_x509_crt _trustStore;
+  static const uint8_t* _bundle;
+  static bool _trustStoreParsed;
+  static SemaphoreHandle_t _trustStoreMutex;
+
+  // taken from a pool by connect() and given back by stop(), so idle
+  // instances don't hold the mbedTLS state
+  struct Contexts {
+    mbedtls_entropy_context entropyContext;
+    mbedtls_ctr_drbg_context ctrDrbgContext;
+    mbedtls_ssl_context sslContext;
+    mbedtls_ssl_config sslConfig;
+    int verifyTop; // depth of the top of the chain verified, -1 before
+  };
+
+  static BufferPool _contextsPool;
+
+  Contexts* _contexts;
   mbedtls_net_context _netContext;
-  mbedtls_x509_crt _caCrt;
   bool _connected;
   int _peek;
 
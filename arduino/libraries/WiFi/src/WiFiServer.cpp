@@ -27,14 +27,34 @@
 
 WiFiServer::WiFiServer() :
   _port(0),
-  _socket(-1)
+  _socket(-1),
+  _nextSpawned(0),
+  _acceptHead(0),
+  _acceptCount(0),
+  _backlog(WIFI_SERVER_DEFAULT_BACKLOG)
 {
   for (int i = 0; i < CONFIG_LWIP_MAX_SOCKETS; i++) {
     _spawnedSockets[i] = -1;
   }
 }
 
-uint8_t WiFiServer::begin(uint16_t port)
+// closes the listening socket and the connections not handed out yet, the
+// spawned ones belong to their WiFiClient
+WiFiServer::~WiFiServer()
+{
+  while (_acceptCount > 0) {
+    lwip_close_r(_acceptQueue[_acceptHead]);
+
+    _acceptHead = (_acceptHead + 1) % CONFIG_LWIP_MAX_SOCKETS;
+    _acceptCount--;
+  }
+
+  if (_socket != -1) {
+    lwip_close_r(_socket);
+  }
+}
+
+uint8_t WiFiServer::begin(uint16_t port, int backlog)
 {
   _socket = lwip_socket(AF_INET, SOCK_STREAM, 0);
 
@@ -55,7 +75,7 @@ uint8_t WiFiServer::begin(uint16_t port)
     return 0;
   }
 
-  if (lwip_listen(_socket, 1) < 0) {
+  if (lwip_listen(_socket, backlog) < 0) {
     lwip_close_r(_socket);
     _socket = -1;
     return 0;
@@ -67,19 +87,52 @@ uint8_t WiFiServer::begin(uint16_t port)
   // Set port.
   _port = port;
 
+  if (backlog < 1) {
+    backlog = 1;
+  } else if (backlog > CONFIG_LWIP_MAX_SOCKETS) {
+    backlog = CONFIG_LWIP_MAX_SOCKETS;
+  }
+  _backlog = backlog;
+
   return 1;
 }
 
-WiFiClient WiFiServer::available(uint8_t* status)
+// moves the connections completed by lwIP into the accept queue, up to the
+// backlog given to begin(), further ones are left to lwIP's own backlog
+void WiFiServer::acceptPending()
+{
+  while (_socket != -1 && _acceptCount < _backlog) {
+    int result = lwip_accept(_socket, NULL, 0);
+
+    if (result == -1) {
+      break;
+    }
+
+    _acceptQueue[(_acceptHead + _acceptCount) % CONFIG_LWIP_MAX_SOCKETS] = result;
+    _acceptCount++;
+  }
+}
+
+int WiFiServer::nextAccepted()
 {
-  int result = -1;
-  if (_accepted_sock >= 0) {
-    result = _accepted_sock;
-    _accepted_sock = -1;
-  } else {
-    result = lwip_accept(_socket, NULL, 0);
+  acceptPending();
+
+  if (_acceptCount == 0) {
+    return -1;
   }
 
+  int result = _acceptQueue[_acceptHead];
+
+  _acceptHead = (_acceptHead + 1) % CONFIG_LWIP_MAX_SOCKETS;
+  _acceptCount--;
+
+  return result;
+}
+
+WiFiClient WiFiServer::available(uint8_t* status)
+{
+  int result = nextAccepted();
+
   if (status) {
     *status = (result != -1);
   }
@@ -94,44 +147,64 @@ WiFiClient WiFiServer::available(uint8_t* status)
     }
   }
 
-  result = -1;
+  // one select() over the spawned sockets instead of asking each of them,
+  // closed connections are readable too and get cleared below. lwIP here has
+  // no per socket event callback that could feed a queue of readable
+  // clients, so finding the next one stays a walk over the readable set,
+  // bounded by CONFIG_LWIP_MAX_SOCKETS.
+  fd_set readSet;
+  int maxFd = -1;
+  struct timeval timeout = { 0, 0 };
+
+  FD_ZERO(&readSet);
 
-  // find an existing socket with data
   for (int i = 0; i < CONFIG_LWIP_MAX_SOCKETS; i++) {
     if (_spawnedSockets[i] != -1) {
-      WiFiClient c(_spawnedSockets[i]);
+      FD_SET(_spawnedSockets[i], &readSet);
 
-      if (!c.connected()) {
-        // socket not connected, clear from book keeping
-        _spawnedSockets[i] = -1;
-      } else if (c.available()) {
-        result = _spawnedSockets[i];
-
-        break;
+      if (_spawnedSockets[i] > maxFd) {
+        maxFd = _spawnedSockets[i];
       }
     }
   }
 
-  return WiFiClient(result);
+  if (maxFd == -1 || lwip_select(maxFd + 1, &readSet, NULL, NULL, &timeout) <= 0) {
+    return WiFiClient(-1);
+  }
+
+  // round robin over the readable sockets, starting after the last one
+  // returned, so a busy client doesn't starve the others
+  for (int n = 0; n < CONFIG_LWIP_MAX_SOCKETS; n++) {
+    int i = (_nextSpawned + n) % CONFIG_LWIP_MAX_SOCKETS;
+
+    if (_spawnedSockets[i] == -1 || !FD_ISSET(_spawnedSockets[i], &readSet)) {
+      continue;
+    }
+
+    WiFiClient c(_spawnedSockets[i]);
+
+    if (!c.connected()) {
+      // socket not connected, clear from book keeping
+      _spawnedSockets[i] = -1;
+    } else if (c.available()) {
+      _nextSpawned = (i + 1) % CONFIG_LWIP_MAX_SOCKETS;
+
+      return c;
+    }
+  }
+
+  return WiFiClient(-1);
 }
 
 WiFiClient WiFiServer::accept()
 {
-  int result = -1;
-  if (_accepted_sock >= 0) {
-    result = _accepted_sock;
-    _accepted_sock = -1;
-  } else {
-    result = lwip_accept(_socket, NULL, 0);
-  }
-  return WiFiClient(result);
+  return WiFiClient(nextAccepted());
 }
 
 bool WiFiServer::hasClient() {
-  if (_accepted_sock != -1) 
-    return true;
-  _accepted_sock = lwip_accept(_socket, NULL, 0);
-  return (_accepted_sock != -1);
+  acceptPending();
+
+  return (_acceptCount > 0);
 }
 
 uint8_t WiFiServer::status() {
@@ -159,6 +232,50 @@ size_t WiFiServer::write(const uint8_t *buffer, size_t size)
   return written;
 }
 
+int WiFiServer::fdSet(fd_set* set)
+{
+  int maxFd = -1;
+
+  if (_socket == -1) {
+    return -1;
+  }
+
+  FD_SET(_socket, set);
+  maxFd = _socket;
+
+  for (int i = 0; i < CONFIG_LWIP_MAX_SOCKETS; i++) {
+    if (_spawnedSockets[i] != -1) {
+      FD_SET(_spawnedSockets[i], set);
+
+      if (_spawnedSockets[i] > maxFd) {
+        maxFd = _spawnedSockets[i];
+      }
+    }
+  }
+
+  return maxFd;
+}
+
+bool WiFiServer::fdIsSet(fd_set* set)
+{
+  if (_socket == -1) {
+    return false;
+  }
+
+  // an already accepted connection or a pending one on the listening socket
+  if (_acceptCount > 0 || FD_ISSET(_socket, set)) {
+    return true;
+  }
+
+  for (int i = 0; i < CONFIG_LWIP_MAX_SOCKETS; i++) {
+    if (_spawnedSockets[i] != -1 && FD_ISSET(_spawnedSockets[i], set)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
 WiFiServer::operator bool()
 {
   return (_port != 0 && _socket != -1);
@@ -22,31 +22,51 @@
 
 #include <sdkconfig.h>
 
+#include <lwip/sockets.h>
+
 #include <Arduino.h>
 // #include <Server.h>
 
+// connections lwIP completes on its own while none is accepted yet
+#define WIFI_SERVER_DEFAULT_BACKLOG 4
+
 class WiFiClient;
 
 class WiFiServer /*: public Server*/ {
 public:
   WiFiServer();
+  ~WiFiServer();
   WiFiClient available(uint8_t* status = NULL);
   WiFiClient accept();
   bool hasClient();
-  uint8_t begin(uint16_t port);
+  uint8_t begin(uint16_t port, int backlog = WIFI_SERVER_DEFAULT_BACKLOG);
   virtual size_t write(uint8_t);
   virtual size_t write(const uint8_t *buf, size_t size);
   uint8_t status();
 
+  // select() support for the listening and spawned sockets
+  int fdSet(fd_set* set);
+  bool fdIsSet(fd_set* set);
+
   // using Print::write;
 
   virtual operator bool();
 
+private:
+  void acceptPending();
+  int nextAccepted();
+
 private:
   uint16_t _port;
   int _socket;
   int _spawnedSockets[CONFIG_LWIP_MAX_SOCKETS];
-  int _accepted_sock = -1;
+  int _nextSpawned; // where the search for a readable socket starts
+
+  // accepted connections not handed out yet, oldest first, at most _backlog
+  int _acceptQueue[CONFIG_LWIP_MAX_SOCKETS];
+  int _acceptHead;
+  int _acceptCount;
+  int _backlog;
 };
 
 #endif // WIFISERVER_H
@@ -24,20 +24,79 @@
 
 #include "WiFi.h"
 
+#include "BufferPool.h"
 #include "WiFiUdp.h"
 
+static BufferPool rcvQueuePool(WIFI_UDP_QUEUE_SIZE, 1);
+static BufferPool sndBufferPool(WIFI_UDP_MAX_DATAGRAM, 1);
+
+class __Guard {
+public:
+  __Guard(SemaphoreHandle_t handle) {
+    _handle = handle;
+
+    xSemaphoreTakeRecursive(_handle, portMAX_DELAY);
+  }
+
+  ~__Guard() {
+    xSemaphoreGiveRecursive(_handle);
+  }
+
+private:
+  SemaphoreHandle_t _handle;
+};
+
+// the queue is filled by the gpio0Updater task and read by the SPI loop
+#define synchronized __Guard __guard(_rcvMutex);
+
 WiFiUDP::WiFiUDP() :
   _socket(-1),
   _remoteIp(0),
   _remotePort(0),
+  _rcvQueue(NULL),
+  _rcvHead(0),
+  _rcvCount(0),
+  _rcvCurrent(false),
   _rcvIndex(0),
   _rcvSize(0),
+  _sndIp(0),
+  _sndPort(0),
+  _sndBuffer(NULL),
   _sndSize(0)
 {
+  _rcvMutex = xSemaphoreCreateRecursiveMutex();
+}
+
+WiFiUDP::~WiFiUDP()
+{
+  if (_socket != -1) {
+    stop();
+  }
+
+  rcvQueuePool.release(_rcvQueue);
+  sndBufferPool.release(_sndBuffer);
+
+  vSemaphoreDelete(_rcvMutex);
 }
 
 uint8_t WiFiUDP::begin(uint16_t port)
 {
+  synchronized {
+    _rcvHead = 0;
+    _rcvCount = 0;
+    _rcvCurrent = false;
+    _rcvIndex = 0;
+    _rcvSize = 0;
+
+    if (_rcvQueue == NULL) {
+      _rcvQueue = (uint8_t*)rcvQueuePool.alloc();
+    }
+  }
+
+  if (_rcvQueue == NULL) {
+    return 0;
+  }
+
   _socket = lwip_socket(AF_INET, SOCK_DGRAM, 0);
 
   if (_socket < 0) {
@@ -89,8 +148,22 @@ int WiFiUDP::available()
 /* Release any resources being used by this WiFiUDP instance */
 void WiFiUDP::stop()
 {
-  lwip_close_r(_socket);
-  _socket = -1;
+  synchronized {
+    lwip_close_r(_socket);
+    _socket = -1;
+
+    _rcvCount = 0;
+    _rcvCurrent = false;
+    _rcvIndex = 0;
+    _rcvSize = 0;
+
+    rcvQueuePool.release(_rcvQueue);
+    _rcvQueue = NULL;
+  }
+
+  sndBufferPool.release(_sndBuffer);
+  _sndBuffer = NULL;
+  _sndSize = 0;
 }
 
 int WiFiUDP::beginPacket(const char *host, uint16_t port)
@@ -109,21 +182,36 @@ int WiFiUDP::beginPacket(/*IPAddress*/uint32_t ip, uint16_t port)
   _remoteIp = ip;
   _remotePort = port;
 
+  _sndIp = ip;
+  _sndPort = port;
   _sndSize = 0;
 
-  return 1;
+  if (_sndBuffer == NULL) {
+    _sndBuffer = (uint8_t*)sndBufferPool.alloc();
+  }
+
+  return (_sndBuffer != NULL);
 }
 
 int WiFiUDP::endPacket()
+{
+  if (_sndBuffer == NULL) {
+    return 0;
+  }
+
+  return sendDatagram(_sndIp, _sndPort, _sndBuffer, _sndSize);
+}
+
+int WiFiUDP::sendDatagram(/*IPAddress*/uint32_t ip, uint16_t port, const uint8_t* buffer, size_t size)
 {
   struct sockaddr_in addr;
   memset(&addr, 0x00, sizeof(addr));
 
   addr.sin_family = AF_INET;
-  addr.sin_addr.s_addr = _remoteIp;
-  addr.sin_port = htons(_remotePort);
+  addr.sin_addr.s_addr = ip;
+  addr.sin_port = htons(port);
 
-  if (lwip_sendto(_socket, _sndBuffer, _sndSize, 0, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+  if (lwip_sendto(_socket, buffer, size, 0, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
     return 0;
   }
 
@@ -139,39 +227,154 @@ size_t WiFiUDP::write(const uint8_t *buffer, size_t size)
 {
   size_t written = size;
 
-  if ((_sndSize + size) > sizeof(_sndBuffer)) {
-    written = sizeof(_sndBuffer) - _sndSize;
+  if (_sndBuffer == NULL) {
+    _sndBuffer = (uint8_t*)sndBufferPool.alloc();
+
+    if (_sndBuffer == NULL) {
+      return 0;
+    }
+  }
+
+  if ((_sndSize + size) > WIFI_UDP_MAX_DATAGRAM) {
+    written = WIFI_UDP_MAX_DATAGRAM - _sndSize;
   }
 
-  memcpy(&_sndBuffer[_sndSize], buffer, size);
+  memcpy(&_sndBuffer[_sndSize], buffer, written);
 
   _sndSize += written;
 
   return written;
 }
 
-int WiFiUDP::parsePacket()
+// receives one datagram into the free space after the last queued one, or
+// at the start of the buffer when there isn't enough room at the end, a
+// datagram is always stored in one piece
+bool WiFiUDP::receive()
 {
+  if (_socket == -1 || _rcvQueue == NULL || _rcvCount == WIFI_UDP_QUEUE_LEN) {
+    return false;
+  }
+
+  int offset = 0;
+
+  if (_rcvCount > 0) {
+    Datagram* first = &_rcvDatagrams[_rcvHead];
+    Datagram* last = &_rcvDatagrams[(_rcvHead + _rcvCount - 1) % WIFI_UDP_QUEUE_LEN];
+    int end = last->offset + last->length;
+
+    if (end > first->offset) {
+      if ((WIFI_UDP_QUEUE_SIZE - end) >= WIFI_UDP_MAX_DATAGRAM) {
+        offset = end;
+      } else if (first->offset >= WIFI_UDP_MAX_DATAGRAM) {
+        offset = 0;
+      } else {
+        return false;
+      }
+    } else if ((first->offset - end) >= WIFI_UDP_MAX_DATAGRAM) {
+      offset = end;
+    } else {
+      return false;
+    }
+  }
+
   struct sockaddr_in addr;
   socklen_t addrLen = sizeof(addr);
 
+  int result = lwip_recvfrom_r(_socket, &_rcvQueue[offset], WIFI_UDP_MAX_DATAGRAM, MSG_DONTWAIT, (struct sockaddr*)&addr, &addrLen);
+
+  if (result <= 0) {
+    return false;
+  }
+
+  Datagram* datagram = &_rcvDatagrams[(_rcvHead + _rcvCount) % WIFI_UDP_QUEUE_LEN];
+
+  datagram->remoteIp = addr.sin_addr.s_addr;
+  datagram->remotePort = ntohs(addr.sin_port);
+  datagram->offset = offset;
+  datagram->length = result;
+  _rcvCount++;
+
+  return true;
+}
+
+// ends the packet being read. It is only removed from the queue once the
+// host has read from it, the gpio0Updater task calls parsePacket() to check
+// for data and a datagram it made current is still unread.
+void WiFiUDP::dropCurrent()
+{
+  if (_rcvCurrent && _rcvIndex > 0) {
+    _rcvHead = (_rcvHead + 1) % WIFI_UDP_QUEUE_LEN;
+    _rcvCount--;
+  }
+
+  _rcvCurrent = false;
   _rcvIndex = 0;
   _rcvSize = 0;
+}
+
+void WiFiUDP::receivePending()
+{
+  bool received;
 
-  int result = lwip_recvfrom_r(_socket, _rcvBuffer, sizeof(_rcvBuffer), MSG_DONTWAIT, (struct sockaddr*)&addr, &addrLen);
+  do {
+    synchronized {
+      received = receive();
+    }
 
-  if (result <= 0) {
-    return 0;
+    // let the SPI loop, which runs at the same priority, read the queue
+    // between datagrams
+    taskYIELD();
+  } while (received);
+}
+
+int WiFiUDP::parsePacket()
+{
+  synchronized {
+    dropCurrent();
+
+    while (receive());
+
+    if (_rcvCount == 0) {
+      return 0;
+    }
+
+    Datagram* datagram = &_rcvDatagrams[_rcvHead];
+
+    _rcvCurrent = true;
+    _rcvSize = datagram->length;
+    _remoteIp = datagram->remoteIp;
+    _remotePort = datagram->remotePort;
+
+    return _rcvSize;
   }
+}
+
+int WiFiUDP::readDatagram(uint8_t* buf, size_t len, /*IPAddress*/uint32_t* ip, uint16_t* port)
+{
+  synchronized {
+    dropCurrent();
 
-  // delay a bit to allow other tasks to run ...
-  vTaskDelay(1);
+    while (receive());
 
-  _rcvSize = result;
-  _remoteIp = addr.sin_addr.s_addr;
-  _remotePort = ntohs(addr.sin_port);
+    if (_rcvCount == 0) {
+      return 0;
+    }
 
-  return result;
+    Datagram* datagram = &_rcvDatagrams[_rcvHead];
+
+    if (datagram->length > len) {
+      return -1;
+    }
+
+    memcpy(buf, &_rcvQueue[datagram->offset], datagram->length);
+    *ip = datagram->remoteIp;
+    *port = datagram->remotePort;
+
+    _rcvHead = (_rcvHead + 1) % WIFI_UDP_QUEUE_LEN;
+    _rcvCount--;
+
+    return datagram->length;
+  }
 }
 
 int WiFiUDP::read()
@@ -187,24 +390,30 @@ int WiFiUDP::read()
 
 int WiFiUDP::read(unsigned char* buf, size_t size)
 {
-  if (available() < (int)size) {
-    size = available();
-  }
+  synchronized {
+    if (available() < (int)size) {
+      size = available();
+    }
 
-  memcpy(buf, &_rcvBuffer[_rcvIndex], size);
+    if (size > 0) {
+      memcpy(buf, &_rcvQueue[_rcvDatagrams[_rcvHead].offset + _rcvIndex], size);
+    }
 
-  _rcvIndex += size;
+    _rcvIndex += size;
 
-  return size;
+    return size;
+  }
 }
 
 int WiFiUDP::peek()
 {
-  if (!available()) {
-    return -1;
-  }
+  synchronized {
+    if (!available()) {
+      return -1;
+    }
 
-  return _rcvBuffer[_rcvIndex];
+    return _rcvQueue[_rcvDatagrams[_rcvHead].offset + _rcvIndex];
+  }
 }
 
 void WiFiUDP::flush()
@@ -20,12 +20,21 @@
 #ifndef WIFIUDP_H
 #define WIFIUDP_H
 
+#include <Arduino.h>
 // #include <Udp.h>
 
+// received datagrams are queued until read, at most WIFI_UDP_QUEUE_LEN of
+// them in a buffer of WIFI_UDP_QUEUE_SIZE bytes taken by begin(), the send
+// buffer is taken by the first packet, both are given back by stop()
+#define WIFI_UDP_QUEUE_LEN 16
+#define WIFI_UDP_QUEUE_SIZE 4096
+#define WIFI_UDP_MAX_DATAGRAM 1500
+
 class WiFiUDP /*: public UDP*/ {
 
 public:
   WiFiUDP();
+  ~WiFiUDP();
   virtual uint8_t begin(uint16_t);
   virtual uint8_t beginMulticast(/*IPAddress*/uint32_t, uint16_t);
   virtual void stop();
@@ -36,6 +45,13 @@ public:
   virtual size_t write(uint8_t);
   virtual size_t write(const uint8_t *buffer, size_t size);
 
+  // sends a datagram right away, without going through the send buffer
+  int sendDatagram(/*IPAddress*/uint32_t ip, uint16_t port, const uint8_t* buffer, size_t size);
+
+  // destination set by beginPacket(), received packets don't change it
+  /*IPAddress*/uint32_t destinationIP() const { return _sndIp; }
+  uint16_t destinationPort() const { return _sndPort; }
+
   // using Print::write;
 
   virtual int parsePacket();
@@ -49,17 +65,46 @@ public:
   virtual /*IPAddress*/ uint32_t remoteIP();
   virtual uint16_t remotePort();
 
+  // moves the datagrams waiting in the socket into the queue
+  void receivePending();
+
+  // ends the current packet (see dropCurrent()) and moves the next queued
+  // datagram, with its source address, into buf, returns its length, 0 when
+  // none is queued and -1 when it is longer than len, in which case it stays
+  // queued
+  int readDatagram(uint8_t* buf, size_t len, /*IPAddress*/uint32_t* ip, uint16_t* port);
+
   virtual operator bool() { return _socket != -1; }
 
+  int fd() const { return _socket; }
+
+private:
+  struct Datagram {
+    uint32_t remoteIp;
+    uint16_t remotePort;
+    uint16_t offset; // in _rcvQueue
+    uint16_t length;
+  };
+
+  bool receive();
+  void dropCurrent();
+
 private:
   int _socket;
   uint32_t _remoteIp;
   uint16_t _remotePort;
 
-  uint8_t _rcvBuffer[1500];
+  SemaphoreHandle_t _rcvMutex;
+  uint8_t* _rcvQueue;
+  Datagram _rcvDatagrams[WIFI_UDP_QUEUE_LEN];
+  int _rcvHead;
+  int _rcvCount;
+  bool _rcvCurrent; // the head datagram is the packet being read
   uint16_t _rcvIndex;
   uint16_t _rcvSize;
-  uint8_t _sndBuffer[1500];
+  uint32_t _sndIp;
+  uint16_t _sndPort;
+  uint8_t* _sndBuffer;
   uint16_t _sndSize;
 };
 
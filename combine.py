@@ -2,10 +2,13 @@
 
 import sys;
 
+sys.path.insert(0, "tools")
+import crt_bundle
+
 booloaderData = open("build/bootloader/bootloader.bin", "rb").read()
 partitionData = open("build/partitions.bin", "rb").read()
 phyData = open("data/phy.bin", "rb").read()
-certsData = open("data/roots.pem", "rb").read()
+certsData = crt_bundle.create_bundle(open("data/roots.pem", "rb").read())
 appData = open("build/nina-fw.bin", "rb").read()
 
 # calculate the output binary size, app offset 
@@ -29,7 +32,7 @@ for i in range(0, len(phyData)):
 for i in range(0, len(certsData)):
         outputData[0x10000 + i] = certsData[i]
 
-# zero terminate the pem file
+# zero terminate the certificates data
 outputData[0x10000 + len(certsData)] = 0
 
 for i in range(0, len(appData)):
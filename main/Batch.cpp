@@ -0,0 +1,84 @@
+/*
+  This file is part of the Arduino NINA firmware.
+  Copyright (c) 2018 Arduino SA. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "Batch.h"
+
+BatchReader::BatchReader(const uint8_t command[], size_t length) :
+  _ptr(&command[3]),
+  _end(&command[length]),
+  _remaining(command[2])
+{
+}
+
+const uint8_t* BatchReader::next(uint16_t* length)
+{
+  if (_remaining == 0 || (_end - _ptr) < 2) {
+    return NULL;
+  }
+
+  uint16_t frameLength = (_ptr[0] << 8) | _ptr[1];
+  const uint8_t* frame = &_ptr[2];
+
+  if ((_end - frame) < frameLength) {
+    return NULL;
+  }
+
+  _ptr = &frame[frameLength];
+  _remaining--;
+
+  *length = frameLength;
+
+  return frame;
+}
+
+BatchWriter::BatchWriter(uint8_t response[], size_t length) :
+  _response(response),
+  _capacity(length),
+  _length(3),
+  _count(0)
+{
+}
+
+uint8_t* BatchWriter::reserve(size_t minRoom, size_t* room)
+{
+  // 2 bytes of parameter length in front, the end byte of the batch behind
+  if ((_length + 2 + minRoom + 1) > _capacity) {
+    return NULL;
+  }
+
+  *room = _capacity - (_length + 2) - 1;
+
+  return &_response[_length + 2];
+}
+
+void BatchWriter::commit(size_t length)
+{
+  _response[_length++] = (length >> 8) & 0xff; // parameter length
+  _response[_length++] = (length >> 0) & 0xff;
+  _length += length;
+  _count++;
+}
+
+int BatchWriter::finish()
+{
+  _response[2] = _count; // number of parameters
+
+  return (_length + 1);
+}
@@ -0,0 +1,69 @@
+/*
+  This file is part of the Arduino NINA firmware.
+  Copyright (c) 2018 Arduino SA. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Frame layout of executeBatch (0x47).
+//
+// Each parameter of the command is a complete command frame with a 2 byte
+// length, each parameter of the response is the complete (unpadded)
+// response frame of one sub-command, again with a 2 byte length.
+
+class BatchReader {
+public:
+  BatchReader(const uint8_t command[], size_t length);
+
+  // returns the next sub-command frame, or NULL once all of them have been
+  // read or if the next one runs past the end of the command buffer
+  const uint8_t* next(uint16_t* length);
+
+private:
+  const uint8_t* _ptr;
+  const uint8_t* _end;
+  uint8_t _remaining;
+};
+
+class BatchWriter {
+public:
+  BatchWriter(uint8_t response[], size_t length);
+
+  // returns where the next sub-response goes and, in room, how many bytes
+  // it may take, or NULL if fewer than minRoom bytes are left
+  uint8_t* reserve(size_t minRoom, size_t* room);
+
+  // accounts for the sub-response written at the reserved position
+  void commit(size_t length);
+
+  // sets the number of parameters, returns the response length including
+  // the end byte
+  int finish();
+
+private:
+  uint8_t* _response;
+  size_t _capacity;
+  size_t _length;
+  uint8_t _count;
+};
+
+#endif
@@ -0,0 +1,37 @@
+/*
+  This file is part of the Arduino NINA firmware.
+  Copyright (c) 2018 Arduino SA. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32 (IEEE 802.3, reflected polynomial 0xedb88320).
+//
+// Both functions update a running CRC: start with 0xffffffff and xor the
+// result with 0xffffffff once all the data has been processed.
+
+// software version, processes 8 bytes per iteration (slicing-by-8)
+uint32_t crc_update(uint32_t crc, const void * data, size_t data_len);
+
+// same result, computed by the crc32_le() function in the ESP32 ROM
+uint32_t crc_update_rom(uint32_t crc, const void * data, size_t data_len);
+
+#endif
@@ -17,6 +17,8 @@
   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
+#include <new>
+
 #include <lwip/sockets.h>
 #include <driver/spi_common.h>
 
@@ -27,6 +29,11 @@
 #include <WiFiUdp.h>
 
 #include "CommandHandler.h"
+#include "Batch.h"
+#include "RxRing.h"
+#include "TxBuffer.h"
+#include "CRC32.h"
+#include "LZSS.h"
 
 #include <BearSSLClient.h>
 #include <BearSSLTrustAnchors.h>
@@ -47,15 +54,463 @@ const char FIRMWARE_VERSION[6] = "2.0.0";
 
 #define MAX_SOCKETS CONFIG_LWIP_MAX_SOCKETS
 
+// socket type of a slot still being connected by networkTask()
+#define SOCKET_TYPE_CONNECTING 0xfe
+
 uint8_t socketTypes[MAX_SOCKETS];
+volatile uint32_t socketsReady = 0; // bit n set when socket n has data or a pending connection
 WiFiClient tcpClients[MAX_SOCKETS];
-WiFiUDP udps[MAX_SOCKETS];
-WiFiSSLClient tlsClients[MAX_SOCKETS];
-WiFiServer tcpServers[MAX_SOCKETS];
+
+// The UDP, TLS client and TCP server objects of a slot share its storage and
+// are only constructed, in place, when startServerTcp or startClientTcp claims
+// the slot for one of them. They are destroyed when the slot is freed again.
+// TCP clients are just a socket and stay in tcpClients[], accepted connections
+// are stored there too.
+enum SocketSlotKind {
+  SOCKET_SLOT_NONE,
+  SOCKET_SLOT_UDP,
+  SOCKET_SLOT_TLS,
+  SOCKET_SLOT_TCP_SERVER,
+};
+
+struct SocketSlot {
+  uint8_t kind;
+
+  union {
+    WiFiUDP udp;
+    WiFiSSLClient tls;
+    WiFiServer tcpServer;
+  };
+
+  SocketSlot() : kind(SOCKET_SLOT_NONE) {}
+  ~SocketSlot() {}
+};
+
+static SocketSlot socketSlots[MAX_SOCKETS];
+// taken by gpio0Updater while it looks at the slots, so that their objects
+// aren't destroyed under it
+static SemaphoreHandle_t socketSlotsMutex;
+
+static WiFiUDP* slotUdp(uint8_t socket)
+{
+  return (socketSlots[socket].kind == SOCKET_SLOT_UDP) ? &socketSlots[socket].udp : NULL;
+}
+
+static WiFiSSLClient* slotTls(uint8_t socket)
+{
+  return (socketSlots[socket].kind == SOCKET_SLOT_TLS) ? &socketSlots[socket].tls : NULL;
+}
+
+static WiFiServer* slotServer(uint8_t socket)
+{
+  return (socketSlots[socket].kind == SOCKET_SLOT_TCP_SERVER) ? &socketSlots[socket].tcpServer : NULL;
+}
+
+// called with socketSlotsMutex taken, the destructors close the sockets
+static void destroySlot(uint8_t socket)
+{
+  SocketSlot* slot = &socketSlots[socket];
+
+  if (slot->kind == SOCKET_SLOT_UDP) {
+    slot->udp.~WiFiUDP();
+  } else if (slot->kind == SOCKET_SLOT_TLS) {
+    slot->tls.~WiFiSSLClient();
+  } else if (slot->kind == SOCKET_SLOT_TCP_SERVER) {
+    slot->tcpServer.~WiFiServer();
+  }
+
+  slot->kind = SOCKET_SLOT_NONE;
+}
+
+static void releaseSlot(uint8_t socket)
+{
+  xSemaphoreTake(socketSlotsMutex, portMAX_DELAY);
+
+  destroySlot(socket);
+
+  xSemaphoreGive(socketSlotsMutex);
+}
+
+static void rxRingDisable(uint8_t socket);
+static void txBufferDisable(uint8_t socket);
+
+// a slot already holding an object of this kind keeps it, as UDP sockets are
+// claimed by both begin() and beginPacket()
+static void claimSlot(uint8_t socket, uint8_t kind)
+{
+  SocketSlot* slot = &socketSlots[socket];
+
+  if (slot->kind == kind) {
+    return;
+  }
+
+  if (slot->kind == SOCKET_SLOT_NONE && socketTypes[socket] == 0x00) {
+    // a TCP client claimed for something else without being stopped first
+    txBufferDisable(socket);
+    rxRingDisable(socket);
+    tcpClients[socket].stop();
+    socketTypes[socket] = 255;
+  }
+
+  xSemaphoreTake(socketSlotsMutex, portMAX_DELAY);
+
+  if (slot->kind != SOCKET_SLOT_NONE) {
+    // claimed for something else without being stopped first
+    socketTypes[socket] = 255;
+    destroySlot(socket);
+  }
+
+  if (kind == SOCKET_SLOT_UDP) {
+    new (&slot->udp) WiFiUDP();
+  } else if (kind == SOCKET_SLOT_TLS) {
+    new (&slot->tls) WiFiSSLClient();
+  } else if (kind == SOCKET_SLOT_TCP_SERVER) {
+    new (&slot->tcpServer) WiFiServer();
+  }
+
+  slot->kind = kind;
+
+  xSemaphoreGive(socketSlotsMutex);
+}
 
 WiFiClient bearssl_tcp_client;
 BearSSLClient bearsslClient(bearssl_tcp_client, ArduinoIoTCloudTrustAnchor, ArduinoIoTCloudTrustAnchor_NUM);
 
+#define UDIV_UP(a, b) (((a) + (b) - 1) / (b))
+#define ALIGN_UP(a, b) (UDIV_UP(a, b) * (b))
+
+// Data received on TCP client sockets is moved by the gpio0Updater task into
+// a ring per socket (see RxRing.h) as soon as the socket becomes readable.
+static RxRing rxRings[MAX_SOCKETS];
+static SemaphoreHandle_t rxRingsMutex;
+
+static int rxRingRecv(int fd, uint8_t* buf, size_t len)
+{
+  int result = lwip_recv_r(fd, buf, len, MSG_DONTWAIT);
+
+  if (result > 0) {
+    return result;
+  } else if (result < 0 && errno == EWOULDBLOCK) {
+    return 0;
+  }
+
+  return -1;
+}
+
+static void rxRingEnable(uint8_t socket)
+{
+  xSemaphoreTake(rxRingsMutex, portMAX_DELAY);
+  rxRings[socket].enable();
+  xSemaphoreGive(rxRingsMutex);
+}
+
+// after this returns the socket is no longer read by gpio0Updater and can
+// be closed
+static void rxRingDisable(uint8_t socket)
+{
+  xSemaphoreTake(rxRingsMutex, portMAX_DELAY);
+  rxRings[socket].disable();
+  xSemaphoreGive(rxRingsMutex);
+}
+
+// returns false if the socket has to be read directly from now on
+static bool rxRingFill(uint8_t socket)
+{
+  xSemaphoreTake(rxRingsMutex, portMAX_DELAY);
+  bool allocated = rxRings[socket].fill(tcpClients[socket].fd(), rxRingRecv);
+  xSemaphoreGive(rxRingsMutex);
+
+  return allocated;
+}
+
+static int rxRingRead(uint8_t socket, uint8_t* buf, size_t len, bool peek)
+{
+  xSemaphoreTake(rxRingsMutex, portMAX_DELAY);
+  int read = rxRings[socket].read(buf, len, peek);
+  xSemaphoreGive(rxRingsMutex);
+
+  return read;
+}
+
+static uint8_t* rxRingTake(uint8_t socket, size_t len, size_t* length)
+{
+  xSemaphoreTake(rxRingsMutex, portMAX_DELAY);
+  uint8_t* buffer = rxRings[socket].take(len, length);
+  xSemaphoreGive(rxRingsMutex);
+
+  return buffer;
+}
+
+// Writes to a TCP client socket can be collected in a transmit buffer (see
+// TxBuffer.h), set up with setTcpCoalescing, and sent together once it holds
+// threshold bytes, no write came for timeout ms (checked by the gpio0Updater
+// task) or the host asks for it with flushDataTcp.
+static TxBuffer txBuffers[MAX_SOCKETS];
+static SemaphoreHandle_t txBuffersMutex;
+
+// how long turning a transmit buffer off waits for the socket to take what
+// is still buffered, the host already counted it as written
+#define TX_BUFFER_DRAIN_TIMEOUT 1000
+
+// only what fits in the socket send buffer right now is sent, accepted
+// sockets are blocking
+static size_t txBufferSend(int socket, const uint8_t* buf, size_t len)
+{
+  int result = lwip_send_r(tcpClients[socket].fd(), buf, len, MSG_DONTWAIT);
+
+  return (result < 0) ? 0 : result;
+}
+
+// waits up to TX_BUFFER_DRAIN_TIMEOUT ms for the socket to take everything,
+// gives up early once the connection failed
+static size_t txBufferSendDrain(int socket, const uint8_t* buf, size_t len)
+{
+  int fd = tcpClients[socket].fd();
+  TickType_t start = xTaskGetTickCount();
+  size_t written = 0;
+
+  while (fd != -1 && written < len) {
+    int result = lwip_send_r(fd, &buf[written], len - written, MSG_DONTWAIT);
+
+    if (result > 0) {
+      written += result;
+      continue;
+    } else if (result < 0 && errno != EWOULDBLOCK && errno != EAGAIN) {
+      break;
+    }
+
+    uint32_t elapsed = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+
+    if (elapsed >= TX_BUFFER_DRAIN_TIMEOUT) {
+      break;
+    }
+
+    uint32_t remaining = TX_BUFFER_DRAIN_TIMEOUT - elapsed;
+    fd_set wset;
+    struct timeval tv = {
+      .tv_sec  = remaining / 1000,
+      .tv_usec = (remaining % 1000) * 1000,
+    };
+
+    FD_ZERO(&wset);
+    FD_SET(fd, &wset);
+
+    if (lwip_select(fd + 1, NULL, &wset, NULL, &tv) <= 0) {
+      break;
+    }
+  }
+
+  return written;
+}
+
+static void txBufferEnable(uint8_t socket, uint16_t threshold, uint16_t timeout)
+{
+  xSemaphoreTake(txBuffersMutex, portMAX_DELAY);
+  txBuffers[socket].enable(threshold, timeout);
+  xSemaphoreGive(txBuffersMutex);
+}
+
+// returns true when everything was sent
+static bool txBufferFlush(uint8_t socket)
+{
+  xSemaphoreTake(txBuffersMutex, portMAX_DELAY);
+  bool result = txBuffers[socket].flush(socket, txBufferSend);
+  xSemaphoreGive(txBuffersMutex);
+
+  return result;
+}
+
+static size_t txBufferWrite(uint8_t socket, const uint8_t* data, size_t len)
+{
+  xSemaphoreTake(txBuffersMutex, portMAX_DELAY);
+  bool wasEmpty = (txBuffers[socket].length() == 0);
+  size_t written = txBuffers[socket].write(socket, txBufferSend, data, len, xTaskGetTickCount());
+  bool armed = (wasEmpty && txBuffers[socket].length() > 0);
+  xSemaphoreGive(txBuffersMutex);
+
+  if (armed) {
+    // gpio0Updater has to start waiting for the timeout of this buffer
+    CommandHandler.updateSocketsReady();
+  }
+
+  return written;
+}
+
+// goes back to unbuffered writes once the socket took everything, returns
+// false, with the buffer left as it is, if it didn't in time
+static bool txBufferStop(uint8_t socket)
+{
+  xSemaphoreTake(txBuffersMutex, portMAX_DELAY);
+
+  bool sent = txBuffers[socket].flush(socket, txBufferSendDrain);
+
+  if (sent) {
+    txBuffers[socket].disable(socket, txBufferSend);
+  }
+
+  xSemaphoreGive(txBuffersMutex);
+
+  return sent;
+}
+
+// for a socket being closed, what it doesn't take in time is lost with the
+// connection. Has to be called for every client socket before its slot is
+// used by another connection.
+static void txBufferDisable(uint8_t socket)
+{
+  xSemaphoreTake(txBuffersMutex, portMAX_DELAY);
+  txBuffers[socket].disable(socket, txBufferSendDrain);
+  xSemaphoreGive(txBuffersMutex);
+}
+
+// sends the buffers whose timeout expired, returns the ticks until the next
+// one expires
+static TickType_t txBuffersFlushExpired()
+{
+  TickType_t wait = portMAX_DELAY;
+  TickType_t now = xTaskGetTickCount();
+
+  xSemaphoreTake(txBuffersMutex, portMAX_DELAY);
+
+  for (int i = 0; i < MAX_SOCKETS; i++) {
+    TickType_t expires = txBuffers[i].flushExpired(i, txBufferSend, now);
+
+    if (expires < wait) {
+      wait = expires;
+    }
+  }
+
+  xSemaphoreGive(txBuffersMutex);
+
+  return wait;
+}
+
+// response buffer of the command being handled and, when getDataBufTcp()
+// answers it with a receive segment, the segment sent in its place
+static uint8_t* commandResponse = NULL;
+static uint8_t* segmentResponse = NULL;
+
+// bytes the handler may write to its response buffer, less than the whole
+// buffer for a sub-command of executeBatch(). Handlers that return as much
+// data as the host asks for clamp it to this, the others answer with at most
+// BATCH_RESPONSE_RESERVE bytes (scanNetworks() being the largest).
+static size_t responseCapacity = SPI_MAX_DMA_LEN;
+
+#define BATCH_RESPONSE_RESERVE (4 + MAX_SCAN_RESULTS * (1 + 32))
+
+// bytes of the command frame being handled, the sub-command frame for
+// executeBatch(). Handlers with data of a host given length clamp it to this.
+static size_t commandCapacity = SPI_MAX_DMA_LEN;
+
+// length of the data at offset in the command, clamped to the frame
+static size_t commandDataLength(size_t offset, size_t length)
+{
+  if (offset >= commandCapacity) {
+    return 0;
+  }
+
+  return LWIP_MIN(length, commandCapacity - offset);
+}
+
+// Commands that can take seconds (connects, DNS lookups, scans) can be handed
+// to networkTask(), which runs on the other core, so that the SPI loop keeps
+// serving the other sockets. Their results are picked up by a later command
+// through a completion record, or through socketTypes[] for connects. DNS
+// lookups have their own queue and task, so they don't wait behind a TLS
+// handshake.
+enum NetworkJobKind {
+  NETWORK_JOB_CONNECT,
+  NETWORK_JOB_HOST_BY_NAME,
+  NETWORK_JOB_SCAN,
+};
+
+struct NetworkJob {
+  uint8_t kind;
+  uint8_t socket;
+  uint8_t type;
+  char host[255 + 1];
+  uint32_t ip;
+  uint16_t port;
+  uint32_t sequence;
+};
+
+struct NetworkCompletion {
+  uint32_t requested;          // sequence of the last job queued
+  volatile uint32_t completed; // sequence of the last job done
+  SemaphoreHandle_t done;
+};
+
+static QueueHandle_t networkJobs;
+static QueueHandle_t hostByNameJobs;
+static NetworkCompletion hostByNameCompletion;
+static NetworkCompletion scanCompletion;
+static volatile int scanCount;
+static uint32_t scanCollected;
+static volatile bool connectCancelled[MAX_SOCKETS];
+static uint8_t connectTypes[MAX_SOCKETS];
+
+// held by networkConnect() while it hands a socket back, so stopClientTcp()
+// either cancels the connect before that or stops the connected socket
+static SemaphoreHandle_t connectMutex;
+
+// bearsslClient is a single instance, only one socket can use it at a time
+static bool bearsslClientInUse()
+{
+  for (int i = 0; i < MAX_SOCKETS; i++) {
+    if (socketTypes[i] == 0x04 || (socketTypes[i] == SOCKET_TYPE_CONNECTING && connectTypes[i] == 0x04)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static bool queueNetworkJob(NetworkJob* job, NetworkCompletion* completion)
+{
+  if (completion) {
+    job->sequence = ++completion->requested;
+  }
+
+  QueueHandle_t jobs = (job->kind == NETWORK_JOB_HOST_BY_NAME) ? hostByNameJobs : networkJobs;
+
+  if (xQueueSend(jobs, job, 0) != pdTRUE) {
+    if (completion) {
+      completion->requested--;
+    }
+
+    return false;
+  }
+
+  return true;
+}
+
+static void waitNetworkJob(NetworkCompletion* completion)
+{
+  while (completion->completed != completion->requested) {
+    xSemaphoreTake(completion->done, portMAX_DELAY);
+  }
+}
+
+// held around the WiFiClass calls that change the connection, or read the
+// scan results, and around a scan on networkTask(), which stops and restarts
+// the station. The status getters only read state cached by WiFiClass and
+// don't take it, so they answer while a scan is running.
+static SemaphoreHandle_t wifiMutex;
+
+// holds wifiMutex until the end of the scope
+class WiFiLock {
+public:
+  WiFiLock()
+  {
+    xSemaphoreTake(wifiMutex, portMAX_DELAY);
+  }
+
+  ~WiFiLock()
+  {
+    xSemaphoreGive(wifiMutex);
+  }
+};
+
 int setNet(const uint8_t command[], uint8_t response[])
 {
   char ssid[32 + 1];
@@ -63,6 +518,7 @@ int setNet(const uint8_t command[], uint8_t response[])
   memset(ssid, 0x00, sizeof(ssid));
   memcpy(ssid, &command[4], command[3]);
 
+  WiFiLock lock;
   WiFi.begin(ssid);
 
   response[2] = 1; // number of parameters
@@ -83,6 +539,7 @@ int setPassPhrase(const uint8_t command[], uint8_t response[])
   memcpy(ssid, &command[4], command[3]);
   memcpy(pass, &command[5 + command[3]], command[4 + command[3]]);
 
+  WiFiLock lock;
   WiFi.begin(ssid, pass);
 
   response[2] = 1; // number of parameters
@@ -103,6 +560,7 @@ int setKey(const uint8_t command[], uint8_t response[])
   memcpy(ssid, &command[4], command[3]);
   memcpy(key, &command[7 + command[3]], command[6 + command[3]]);
 
+  WiFiLock lock;
   WiFi.begin(ssid, key);
 
   response[2] = 1; // number of parameters
@@ -124,7 +582,9 @@ int setIPconfig(const uint8_t command[], uint8_t response[])
 
   response[2] = 1; // number of parameters
   response[3] = 1; // parameter 1 length
+  response[4] = 1;
 
+  WiFiLock lock;
   WiFi.config(ip, gwip, mask);
 
   return 6;
@@ -138,6 +598,7 @@ int setDNSconfig(const uint8_t command[], uint8_t response[])
   memcpy(&dns1, &command[6], sizeof(dns1));
   memcpy(&dns2, &command[11], sizeof(dns2));
 
+  WiFiLock lock;
   WiFi.setDNS(dns1, dns2);
 
   response[2] = 1; // number of parameters
@@ -158,6 +619,7 @@ int setHostname(const uint8_t command[], uint8_t response[])
   response[3] = 1; // parameter 1 length
   response[4] = 1;
 
+  WiFiLock lock;
   WiFi.hostname(hostname);
 
   return 6;
@@ -167,9 +629,11 @@ int setPowerMode(const uint8_t command[], uint8_t response[])
 {
   if (command[4]) {
     // low power
+    WiFiLock lock;
     WiFi.lowPowerMode();
   } else {
     // no low power
+    WiFiLock lock;
     WiFi.noLowPowerMode();
   }
 
@@ -193,7 +657,10 @@ int setApNet(const uint8_t command[], uint8_t response[])
   response[2] = 1; // number of parameters
   response[3] = 1; // parameter 1 length
 
-  if (WiFi.beginAP(ssid, channel) != WL_AP_FAILED) {
+  WiFiLock lock;
+  uint8_t status = WiFi.beginAP(ssid, channel);
+
+  if (status != WL_AP_FAILED) {
     response[4] = 1;
   } else {
     response[4] = 0;
@@ -218,7 +685,10 @@ int setApPassPhrase(const uint8_t command[], uint8_t response[])
   response[2] = 1; // number of parameters
   response[3] = 1; // parameter 1 length
 
-  if (WiFi.beginAP(ssid, pass, channel) != WL_AP_FAILED) {
+  WiFiLock lock;
+  uint8_t status = WiFi.beginAP(ssid, pass, channel);
+
+  if (status != WL_AP_FAILED) {
     response[4] = 1;
   } else {
     response[4] = 0;
@@ -381,7 +851,26 @@ int getCurrEnct(const uint8_t command[], uint8_t response[])
 
 int scanNetworks(const uint8_t command[], uint8_t response[])
 {
-  int num = WiFi.scanNetworks();
+  int num;
+
+  if (scanCollected != scanCompletion.requested && scanCompletion.completed != scanCompletion.requested) {
+    // the scan queued by startScanNetworks() is still running, there are no
+    // networks until it is done and the host polls again
+    response[2] = 0;
+
+    return 4;
+  }
+
+  WiFiLock lock;
+
+  if (scanCollected != scanCompletion.requested) {
+    // collect the results of the scan queued by startScanNetworks()
+    num = scanCount;
+    scanCollected = scanCompletion.requested;
+  } else {
+    num = WiFi.scanNetworks();
+  }
+
   int responseLength = 3;
 
   response[2] = num;
@@ -405,12 +894,18 @@ int startServerTcp(const uint8_t command[], uint8_t response[])
   uint16_t port;
   uint8_t socket;
   uint8_t type;
+  uint8_t backlog = WIFI_SERVER_DEFAULT_BACKLOG;
 
-  if (command[2] == 3) {
+  if (command[3] == sizeof(port)) {
     memcpy(&port, &command[4], sizeof(port));
     port = ntohs(port);
     socket = command[7];
     type = command[9];
+
+    // optional 4th parameter: accept backlog of a TCP server
+    if (command[2] == 4 && command[11] != 0) {
+      backlog = command[11];
+    }
   } else {
     memcpy(&ip, &command[4], sizeof(ip));
     memcpy(&port, &command[9], sizeof(port));
@@ -422,17 +917,32 @@ int startServerTcp(const uint8_t command[], uint8_t response[])
   response[2] = 1; // number of parameters
   response[3] = 1; // parameter 1 length
 
-  if (type == 0x00 && tcpServers[socket].begin(port)) {
-    socketTypes[socket] = 0x00;
-    response[4] = 1;
-  } else if (type == 0x01 && udps[socket].begin(port)) {
-    socketTypes[socket] = 0x01;
-    response[4] = 1;
-  } else if (type == 0x03 && udps[socket].beginMulticast(ip, port)) {
-    socketTypes[socket] = 0x01;
-    response[4] = 1;
-  } else {
-    response[4] = 0;
+  response[4] = 0;
+
+  if (socketTypes[socket] == SOCKET_TYPE_CONNECTING) {
+    // networkTask() still uses the slot, stopClientTcp cancels the connect
+    return 6;
+  }
+
+  if (type == 0x00) {
+    claimSlot(socket, SOCKET_SLOT_TCP_SERVER);
+
+    if (slotServer(socket)->begin(port, backlog)) {
+      socketTypes[socket] = 0x00;
+      response[4] = 1;
+    }
+  } else if (type == 0x01 || type == 0x03) {
+    claimSlot(socket, SOCKET_SLOT_UDP);
+
+    if (type == 0x01 ? slotUdp(socket)->begin(port) : slotUdp(socket)->beginMulticast(ip, port)) {
+      socketTypes[socket] = 0x01;
+      response[4] = 1;
+    }
+  }
+
+  if (response[4] == 0) {
+    socketTypes[socket] = 255;
+    releaseSlot(socket);
   }
 
   return 6;
@@ -445,7 +955,7 @@ int getStateTcp(const uint8_t command[], uint8_t response[])
   response[2] = 1; // number of parameters
   response[3] = 1; // parameter 1 length
 
-  if (tcpServers[socket]) {
+  if (slotServer(socket) != NULL) {
     response[4] = 1;
   } else {
     response[4] = 0;
@@ -471,7 +981,7 @@ int availDataTcp(const uint8_t command[], uint8_t response[])
   uint16_t available = 0;
 
   if (socketTypes[socket] == 0x00) {
-    if (tcpServers[socket]) {
+    if (slotServer(socket) != NULL) {
 
       uint8_t accept = command[6];
       available = 255;
@@ -479,8 +989,9 @@ int availDataTcp(const uint8_t command[], uint8_t response[])
       if (accept) {
         for (int i = 0; i < MAX_SOCKETS; i++) {
           if (socketTypes[i] == 255) {
-            WiFiClient client = tcpServers[socket].accept();
+            WiFiClient client = slotServer(socket)->accept();
             if (client) {
+              rxRingEnable(i);
               socketTypes[i] = 0x00;
               tcpClients[i] = client;
               available = i;
@@ -489,7 +1000,7 @@ int availDataTcp(const uint8_t command[], uint8_t response[])
           }
         }
      } else {
-      WiFiClient client = tcpServers[socket].available();
+      WiFiClient client = slotServer(socket)->available();
       if (client) {
         // try to find existing socket slot
         for (int i = 0; i < MAX_SOCKETS; i++) {
@@ -522,13 +1033,15 @@ int availDataTcp(const uint8_t command[], uint8_t response[])
         }
       }
      }
+    } else if (rxRings[socket].enabled()) {
+      available = rxRings[socket].count();
     } else {
       available = tcpClients[socket].available();
     }
   } else if (socketTypes[socket] == 0x01) {
-    available = udps[socket].available();
+    available = slotUdp(socket)->available();
   } else if (socketTypes[socket] == 0x02) {
-    available = tlsClients[socket].available();
+    available = slotTls(socket)->available();
   } else if (socketTypes[socket] == 0x04) {
     available = bearsslClient.available();
   }
@@ -548,8 +1061,13 @@ int getDataTcp(const uint8_t command[], uint8_t response[])
 
   response[2] = 1; // number of parameters
   response[3] = 1; // parameter 1 length
+  response[4] = 0;
 
-  if (socketTypes[socket] == 0x00) {
+  if (socketTypes[socket] == 0x00 && rxRings[socket].enabled()) {
+    if (rxRingRead(socket, &response[4], 1, peek) != 1) {
+      response[4] = -1;
+    }
+  } else if (socketTypes[socket] == 0x00) {
     if (peek) {
       response[4] = tcpClients[socket].peek();
     } else {
@@ -557,15 +1075,15 @@ int getDataTcp(const uint8_t command[], uint8_t response[])
     }
   } else if (socketTypes[socket] == 0x01) {
     if (peek) {
-      response[4] = udps[socket].peek();
+      response[4] = slotUdp(socket)->peek();
     } else {
-      response[4] = udps[socket].read();
+      response[4] = slotUdp(socket)->read();
     }
   } else if (socketTypes[socket] == 0x02) {
     if (peek) {
-      response[4] = tlsClients[socket].peek();
+      response[4] = slotTls(socket)->peek();
     } else {
-      response[4] = tlsClients[socket].read();
+      response[4] = slotTls(socket)->read();
     }
   } else if (socketTypes[socket] == 0x04) {
     if (peek) {
@@ -604,41 +1122,174 @@ static void configureECCx08() {
   ESP_LOGI("ECCX08", "ArduinoBearSSL configured");
 }
 
-int startClientTcp(const uint8_t command[], uint8_t response[])
+static void networkConnect(const NetworkJob& job)
 {
-  char host[255 + 1];
-  uint32_t ip;
-  uint16_t port;
-  uint8_t socket;
-  uint8_t type;
-
-  memset(host, 0x00, sizeof(host));
+  int result;
 
-  if (command[2] == 4) {
-    memcpy(&ip, &command[4], sizeof(ip));
-    memcpy(&port, &command[9], sizeof(port));
-    port = ntohs(port);
-    socket = command[12];
-    type = command[14];
+  if (job.type == 0x00) {
+    if (job.host[0] != '\0') {
+      result = tcpClients[job.socket].connect(job.host, job.port);
+    } else {
+      result = tcpClients[job.socket].connect(job.ip, job.port);
+    }
+  } else if (job.type == 0x02) {
+    if (job.host[0] != '\0') {
+      result = slotTls(job.socket)->connect(job.host, job.port);
+    } else {
+      result = slotTls(job.socket)->connect(job.ip, job.port);
+    }
   } else {
-    memcpy(host, &command[4], command[3]);
-    memcpy(&ip, &command[5 + command[3]], sizeof(ip));
-    memcpy(&port, &command[10 + command[3]], sizeof(port));
-    port = ntohs(port);
-    socket = command[13 + command[3]];
-    type = command[15 + command[3]];
+    configureECCx08();
+
+    if (job.host[0] != '\0') {
+      result = bearsslClient.connect(job.host, job.port);
+    } else {
+      result = bearsslClient.connect(job.ip, job.port);
+    }
   }
 
-  if (type == 0x00) {
-    int result;
+  xSemaphoreTake(connectMutex, portMAX_DELAY);
 
-    if (host[0] != '\0') {
-      result = tcpClients[socket].connect(host, port);
+  if (result && connectCancelled[job.socket]) {
+    // stopClientTcp() was called while connecting
+    if (job.type == 0x00) {
+      tcpClients[job.socket].stop();
+    } else if (job.type == 0x02) {
+      slotTls(job.socket)->stop();
+    } else {
+      bearsslClient.stop();
+    }
+    result = 0;
+  }
+
+  if (result && job.type == 0x00) {
+    rxRingEnable(job.socket);
+  } else if (!result && job.type == 0x02) {
+    releaseSlot(job.socket);
+  }
+
+  // hand the slot back to the command handlers
+  socketTypes[job.socket] = result ? job.type : 255;
+
+  xSemaphoreGive(connectMutex);
+
+  CommandHandler.updateSocketsReady();
+}
+
+static void networkTask(void* jobs)
+{
+  NetworkJob job;
+
+  while (1) {
+    xQueueReceive((QueueHandle_t)jobs, &job, portMAX_DELAY);
+
+    if (job.kind == NETWORK_JOB_CONNECT) {
+      networkConnect(job);
+    } else if (job.kind == NETWORK_JOB_HOST_BY_NAME) {
+      uint32_t ip = 0xffffffff;
+
+      if (!WiFi.hostByName(job.host, ip)) {
+        ip = 0xffffffff;
+      }
+      resolvedHostname = ip;
+
+      hostByNameCompletion.completed = job.sequence;
+      xSemaphoreGive(hostByNameCompletion.done);
+    } else if (job.kind == NETWORK_JOB_SCAN) {
+      {
+        WiFiLock lock;
+
+        scanCount = WiFi.scanNetworks();
+      }
+
+      scanCompletion.completed = job.sequence;
+      xSemaphoreGive(scanCompletion.done);
+    }
+  }
+}
+
+int startClientTcp(const uint8_t command[], uint8_t response[])
+{
+  char host[255 + 1];
+  uint32_t ip;
+  uint16_t port;
+  uint8_t socket;
+  uint8_t type;
+
+  memset(host, 0x00, sizeof(host));
+
+  if (command[2] == 4) {
+    memcpy(&ip, &command[4], sizeof(ip));
+    memcpy(&port, &command[9], sizeof(port));
+    port = ntohs(port);
+    socket = command[12];
+    type = command[14];
+  } else {
+    memcpy(host, &command[4], command[3]);
+    memcpy(&ip, &command[5 + command[3]], sizeof(ip));
+    memcpy(&port, &command[10 + command[3]], sizeof(port));
+    port = ntohs(port);
+    socket = command[13 + command[3]];
+    type = command[15 + command[3]];
+  }
+
+  if (socketTypes[socket] == SOCKET_TYPE_CONNECTING) {
+    // networkTask() still uses the slot, stopClientTcp cancels the connect
+    response[2] = 0; // number of parameters
+
+    return 4;
+  }
+
+  if (type == (0x00 | 0x80) || type == (0x02 | 0x80) || type == (0x04 | 0x80)) {
+    // asynchronous connect, getClientStateTcp() reports the progress
+    NetworkJob job;
+
+    job.kind = NETWORK_JOB_CONNECT;
+    job.socket = socket;
+    job.type = (type & 0x7f);
+    memcpy(job.host, host, sizeof(job.host));
+    job.ip = ip;
+    job.port = port;
+
+    if (job.type == 0x04 && bearsslClientInUse()) {
+      response[2] = 0; // number of parameters
+
+      return 4;
+    }
+
+    if (job.type == 0x02) {
+      claimSlot(socket, SOCKET_SLOT_TLS);
+    }
+
+    connectCancelled[socket] = false;
+    connectTypes[socket] = job.type;
+    socketTypes[socket] = SOCKET_TYPE_CONNECTING;
+
+    if (!queueNetworkJob(&job, NULL)) {
+      socketTypes[socket] = 255;
+      releaseSlot(socket);
+
+      response[2] = 0; // number of parameters
+
+      return 4;
+    }
+
+    response[2] = 1; // number of parameters
+    response[3] = 1; // parameter 1 length
+    response[4] = 1;
+
+    return 6;
+  } else if (type == 0x00) {
+    int result;
+
+    if (host[0] != '\0') {
+      result = tcpClients[socket].connect(host, port);
     } else {
       result = tcpClients[socket].connect(ip, port);
     }
 
     if (result) {
+      rxRingEnable(socket);
       socketTypes[socket] = 0x00;
 
       response[2] = 1; // number of parameters
@@ -654,10 +1305,12 @@ int startClientTcp(const uint8_t command[], uint8_t response[])
   } else if (type == 0x01) {
     int result;
 
+    claimSlot(socket, SOCKET_SLOT_UDP);
+
     if (host[0] != '\0') {
-      result = udps[socket].beginPacket(host, port);
+      result = slotUdp(socket)->beginPacket(host, port);
     } else {
-      result = udps[socket].beginPacket(ip, port);
+      result = slotUdp(socket)->beginPacket(ip, port);
     }
 
     if (result) {
@@ -669,6 +1322,11 @@ int startClientTcp(const uint8_t command[], uint8_t response[])
 
       return 6;
     } else {
+      if (socketTypes[socket] != 0x01) {
+        // not begun before either
+        releaseSlot(socket);
+      }
+
       response[2] = 0; // number of parameters
 
       return 4;
@@ -676,10 +1334,12 @@ int startClientTcp(const uint8_t command[], uint8_t response[])
   } else if (type == 0x02) {
     int result;
 
+    claimSlot(socket, SOCKET_SLOT_TLS);
+
     if (host[0] != '\0') {
-      result = tlsClients[socket].connect(host, port);
+      result = slotTls(socket)->connect(host, port);
     } else {
-      result = tlsClients[socket].connect(ip, port);
+      result = slotTls(socket)->connect(ip, port);
     }
 
     if (result) {
@@ -691,6 +1351,9 @@ int startClientTcp(const uint8_t command[], uint8_t response[])
 
       return 6;
     } else {
+      socketTypes[socket] = 255;
+      releaseSlot(socket);
+
       response[2] = 0; // number of parameters
 
       return 4;
@@ -698,6 +1361,12 @@ int startClientTcp(const uint8_t command[], uint8_t response[])
   } else if (type == 0x04) {
     int result;
 
+    if (bearsslClientInUse()) {
+      response[2] = 0; // number of parameters
+
+      return 4;
+    }
+
     configureECCx08();
 
     if (host[0] != '\0') {
@@ -730,12 +1399,37 @@ int stopClientTcp(const uint8_t command[], uint8_t response[])
 {
   uint8_t socket = command[4];
 
-  if (socketTypes[socket] == 0x00) {
+  if (socketTypes[socket] == SOCKET_TYPE_CONNECTING) {
+    xSemaphoreTake(connectMutex, portMAX_DELAY);
+
+    if (socketTypes[socket] == SOCKET_TYPE_CONNECTING) {
+      // the connect can't be interrupted, networkTask() closes the socket
+      // and frees the slot once it is over
+      connectCancelled[socket] = true;
+
+      xSemaphoreGive(connectMutex);
+
+      response[2] = 1; // number of parameters
+      response[3] = 1; // parameter 1 length
+      response[4] = 1;
+
+      return 6;
+    }
+
+    // the connect was over, stop the socket it left
+    xSemaphoreGive(connectMutex);
+  }
+
+  if (socketTypes[socket] == 0x00 && slotServer(socket) != NULL) {
+    socketTypes[socket] = 255;
+    releaseSlot(socket);
+  } else if (socketTypes[socket] == 0x00) {
+    txBufferDisable(socket);
+    rxRingDisable(socket);
     tcpClients[socket].stop();
-  } else if (socketTypes[socket] == 0x01) {
-    udps[socket].stop();
-  } else if (socketTypes[socket] == 0x02) {
-    tlsClients[socket].stop();
+  } else if (socketTypes[socket] == 0x01 || socketTypes[socket] == 0x02) {
+    socketTypes[socket] = 255;
+    releaseSlot(socket);
   } else if (socketTypes[socket] == 0x04) {
     bearsslClient.stop();
   }
@@ -755,14 +1449,32 @@ int getClientStateTcp(const uint8_t command[], uint8_t response[])
   response[2] = 1; // number of parameters
   response[3] = 1; // parameter 1 length
 
-  if ((socketTypes[socket] == 0x00) && tcpClients[socket].connected()) {
+  if (socketTypes[socket] == SOCKET_TYPE_CONNECTING) {
+    response[4] = connectCancelled[socket] ? 0 : 2; // SYN_SENT while connecting
+  } else if ((socketTypes[socket] == 0x00) && slotServer(socket) != NULL) {
+    response[4] = 1; // LISTEN, the server stays until stopClientTcp
+  } else if ((socketTypes[socket] == 0x00) && rxRings[socket].enabled() && rxRings[socket].connected()) {
+    response[4] = 4;
+  } else if ((socketTypes[socket] == 0x00) && !rxRings[socket].enabled() && tcpClients[socket].connected()) {
     response[4] = 4;
-  } else if ((socketTypes[socket] == 0x02) && tlsClients[socket].connected()) {
+  } else if ((socketTypes[socket] == 0x02) && slotTls(socket)->connected()) {
     response[4] = 4;
   } else if ((socketTypes[socket] == 0x04) && bearsslClient.connected()) {
     response[4] = 4;
   } else {
+    if (socketTypes[socket] == 0x00 && slotServer(socket) == NULL) {
+      // clients without a ring, handed out by availDataTcp or left when the
+      // ring ran out of segments, can have a transmit buffer as well
+      txBufferDisable(socket);
+    }
+
+    if (socketTypes[socket] == 0x00 && rxRings[socket].enabled()) {
+      rxRingDisable(socket);
+      tcpClients[socket].stop();
+    }
+
     socketTypes[socket] = 255;
+    releaseSlot(socket);
     response[4] = 0;
   }
 
@@ -775,6 +1487,7 @@ int disconnect(const uint8_t command[], uint8_t response[])
   response[3] = 1; // parameter 1 length
   response[4] = 1;
 
+  WiFiLock lock;
   WiFi.disconnect();
 
   return 6;
@@ -783,6 +1496,7 @@ int disconnect(const uint8_t command[], uint8_t response[])
 int getIdxRSSI(const uint8_t command[], uint8_t response[])
 {
   // RSSI
+  WiFiLock lock;
   int32_t rssi = WiFi.RSSI(command[4]);
 
   response[2] = 1; // number of parameters
@@ -795,6 +1509,7 @@ int getIdxRSSI(const uint8_t command[], uint8_t response[])
 
 int getIdxEnct(const uint8_t command[], uint8_t response[])
 {
+  WiFiLock lock;
   uint8_t encryptionType = WiFi.encryptionType(command[4]);
 
   response[2] = 1; // number of parameters
@@ -814,8 +1529,14 @@ int reqHostByName(const uint8_t command[], uint8_t response[])
   response[2] = 1; // number of parameters
   response[3] = 1; // parameter 1 length
 
+  // the lookup runs on networkTask(), getHostByName() waits for it
+  NetworkJob job;
+
+  job.kind = NETWORK_JOB_HOST_BY_NAME;
+  memcpy(job.host, host, sizeof(job.host));
+
   resolvedHostname = /*IPAddress(255, 255, 255, 255)*/0xffffffff;
-  if (WiFi.hostByName(host, resolvedHostname)) {
+  if (queueNetworkJob(&job, &hostByNameCompletion)) {
     response[4] = 1;
   } else {
     response[4] = 0;
@@ -826,6 +1547,22 @@ int reqHostByName(const uint8_t command[], uint8_t response[])
 
 int getHostByName(const uint8_t command[], uint8_t response[])
 {
+  //[0]     CMD_START      < 0xE0   >
+  //[1]     Command        < 1 byte >
+  //[2]     N args         < 1 byte >
+  //[3]     no wait size   < 1 byte, optional >
+  //[4]     no wait        < 1 byte, optional >
+  //
+  // Waits for the lookup started by reqHostByName(). With no wait set, a
+  // lookup still running is answered with no parameters instead.
+  if (command[2] >= 1 && command[4] != 0 && hostByNameCompletion.completed != hostByNameCompletion.requested) {
+    response[2] = 0; // number of parameters
+
+    return 4;
+  }
+
+  waitNetworkJob(&hostByNameCompletion);
+
   response[2] = 1; // number of parameters
   response[3] = 4; // parameter 1 length
   memcpy(&response[4], &resolvedHostname, sizeof(resolvedHostname));
@@ -835,9 +1572,19 @@ int getHostByName(const uint8_t command[], uint8_t response[])
 
 int startScanNetworks(const uint8_t command[], uint8_t response[])
 {
+  // the scan runs on networkTask(), scanNetworks() collects the results
+  NetworkJob job;
+
+  job.kind = NETWORK_JOB_SCAN;
+
   response[2] = 1; // number of parameters
   response[3] = 1; // parameter 1 length
-  response[4] = 1;
+
+  if (queueNetworkJob(&job, &scanCompletion)) {
+    response[4] = 1;
+  } else {
+    response[4] = 0;
+  }
 
   return 6;
 }
@@ -859,7 +1606,7 @@ int sendUDPdata(const uint8_t command[], uint8_t response[])
   response[2] = 1; // number of parameters
   response[3] = 1; // parameter 1 length
 
-  if (udps[socket].endPacket()) {
+  if (slotUdp(socket) != NULL && slotUdp(socket)->endPacket()) {
     response[4] = 1;
   } else {
     response[4] = 0;
@@ -879,11 +1626,11 @@ int getRemoteData(const uint8_t command[], uint8_t response[])
     ip = tcpClients[socket].remoteIP();
     port = tcpClients[socket].remotePort();
   } else if (socketTypes[socket] == 0x01) {
-    ip = udps[socket].remoteIP();
-    port = udps[socket].remotePort();
+    ip = slotUdp(socket)->remoteIP();
+    port = slotUdp(socket)->remotePort();
   } else if (socketTypes[socket] == 0x02) {
-    ip = tlsClients[socket].remoteIP();
-    port = tlsClients[socket].remotePort();
+    ip = slotTls(socket)->remoteIP();
+    port = slotTls(socket)->remotePort();
   } else if (socketTypes[socket] == 0x04) {
     ip = static_cast<WiFiClient*>(bearsslClient.getClient())->remoteIP();
     port = static_cast<WiFiClient*>(bearsslClient.getClient())->remotePort();
@@ -917,6 +1664,7 @@ int getIdxBSSID(const uint8_t command[], uint8_t response[])
 {
   uint8_t bssid[6];
 
+  WiFiLock lock;
   WiFi.BSSID(command[4], bssid);
 
   response[2] = 1; // number of parameters
@@ -928,6 +1676,7 @@ int getIdxBSSID(const uint8_t command[], uint8_t response[])
 
 int getIdxChannel(const uint8_t command[], uint8_t response[])
 {
+  WiFiLock lock;
   uint8_t channel = WiFi.channel(command[4]);
 
   response[2] = 1; // number of parameters
@@ -1005,6 +1754,7 @@ int setEnt(const uint8_t command[], uint8_t response[])
     rootCA = (const char*)commandPtr;
     commandPtr += rootCALen;
 
+    WiFiLock lock;
     WiFi.beginEnterprise(ssid, username, password, identity, rootCA);
   } else {
     // EAP-TLS
@@ -1047,6 +1797,7 @@ int setEnt(const uint8_t command[], uint8_t response[])
     rootCA = (const char*)commandPtr;
     commandPtr += rootCALen;
 
+    WiFiLock lock;
     WiFi.beginEnterpriseTLS(ssid, cert, key, identity, rootCA);
   }
 
@@ -1065,14 +1816,16 @@ int sendDataTcp(const uint8_t command[], uint8_t response[])
 
   socket = command[5];
   memcpy(&length, &command[6], sizeof(length));
-  length = ntohs(length);
+  length = commandDataLength(8, ntohs(length));
 
-  if ((socketTypes[socket] == 0x00) && tcpServers[socket]) {
-    written = tcpServers[socket].write(&command[8], length);
+  if ((socketTypes[socket] == 0x00) && slotServer(socket) != NULL) {
+    written = slotServer(socket)->write(&command[8], length);
+  } else if ((socketTypes[socket] == 0x00) && txBuffers[socket].enabled()) {
+    written = txBufferWrite(socket, &command[8], length);
   } else if (socketTypes[socket] == 0x00) {
     written = tcpClients[socket].write(&command[8], length);
   } else if (socketTypes[socket] == 0x02) {
-    written = tlsClients[socket].write(&command[8], length);
+    written = slotTls(socket)->write(&command[8], length);
   } else if (socketTypes[socket] == 0x04) {
     written = bearsslClient.write(&command[8], length);
   }
@@ -1093,12 +1846,33 @@ int getDataBufTcp(const uint8_t command[], uint8_t response[])
   socket = command[5];
   memcpy(&length, &command[8], sizeof(length));
 
-  if (socketTypes[socket] == 0x00) {
+  if (length > (responseCapacity - 6)) {
+    length = (responseCapacity - 6);
+  }
+
+  if (socketTypes[socket] == 0x00 && rxRings[socket].enabled()) {
+    uint8_t* segment = NULL;
+    size_t segmentLength;
+
+    // reads in a batch are copied, their data has to follow the other responses
+    if (response == commandResponse) {
+      segment = rxRingTake(socket, length, &segmentLength);
+    }
+
+    if (segment != NULL) {
+      response = segment;
+      read = segmentLength;
+
+      segmentResponse = segment;
+    } else {
+      read = rxRingRead(socket, &response[5], length, false);
+    }
+  } else if (socketTypes[socket] == 0x00) {
     read = tcpClients[socket].read(&response[5], length);
   } else if (socketTypes[socket] == 0x01) {
-    read = udps[socket].read(&response[5], length);
+    read = slotUdp(socket)->read(&response[5], length);
   } else if (socketTypes[socket] == 0x02) {
-    read = tlsClients[socket].read(&response[5], length);
+    read = slotTls(socket)->read(&response[5], length);
   } else if (socketTypes[socket] == 0x04) {
     read = bearsslClient.read(&response[5], length);
   }
@@ -1121,12 +1895,12 @@ int insertDataBuf(const uint8_t command[], uint8_t response[])
 
   socket = command[5];
   memcpy(&length, &command[6], sizeof(length));
-  length = ntohs(length);
+  length = commandDataLength(8, ntohs(length));
 
   response[2] = 1; // number of parameters
   response[3] = 1; // parameter 1 length
 
-  if (udps[socket].write(&command[8], length) != 0) {
+  if (slotUdp(socket) != NULL && slotUdp(socket)->write(&command[8], length) != 0) {
     response[4] = 1;
   } else {
     response[4] = 0;
@@ -1135,6 +1909,266 @@ int insertDataBuf(const uint8_t command[], uint8_t response[])
   return 6;
 }
 
+int sendUDPpackets(const uint8_t command[], uint8_t response[])
+{
+  //[0]      CMD_START    < 0xE0    >
+  //[1]      Command      < 1 byte  >
+  //[2]      N args       < 1 byte  >
+  //[3..4]   socket size  < 2 bytes >
+  //[5]      socket       < 1 byte  >
+  //[6..7]   dgram 1 size < 2 bytes >
+  //[8]      dgram 1      < remote IP (4 bytes), remote port (2 bytes), data >
+  //         ...          < size and datagram for each further argument >
+  //
+  // A datagram with IP and port 0 goes to the destination of the one before
+  // it, the first one to the destination of beginPacket(). The response is
+  // the number of datagrams sent, sending stops at the first failure.
+  uint8_t socket = command[5];
+  uint8_t count = (command[2] > 0) ? (command[2] - 1) : 0;
+  const uint8_t* paramPtr = &command[6];
+  WiFiUDP* udp = slotUdp(socket);
+  /*IPAddress*/uint32_t ip = 0;
+  uint16_t port = 0;
+  uint8_t sent = 0;
+
+  if (udp != NULL) {
+    ip = udp->destinationIP();
+    port = udp->destinationPort();
+  }
+
+  for (int i = 0; i < count && udp != NULL; i++) {
+    if ((paramPtr + 2) > &command[commandCapacity]) {
+      break;
+    }
+
+    uint16_t paramLength = (paramPtr[0] << 8) | paramPtr[1];
+    const uint8_t* datagram = &paramPtr[2];
+
+    if (paramLength < 6 || (datagram + paramLength) > &command[commandCapacity]) {
+      break;
+    }
+
+    uint32_t datagramIp;
+    uint16_t datagramPort = (datagram[4] << 8) | datagram[5];
+
+    memcpy(&datagramIp, &datagram[0], sizeof(datagramIp));
+
+    if (datagramIp != 0 || datagramPort != 0) {
+      ip = datagramIp;
+      port = datagramPort;
+    }
+
+    if (!udp->sendDatagram(ip, port, &datagram[6], paramLength - 6)) {
+      break;
+    }
+
+    sent++;
+    paramPtr = &datagram[paramLength];
+  }
+
+  response[2] = 1; // number of parameters
+  response[3] = 1; // parameter 1 length
+  response[4] = sent;
+
+  return 6;
+}
+
+static int dispatchCommand(const uint8_t command[], uint8_t response[]);
+
+// sub-command being handled by executeBatch(), zero padded to a whole
+// command buffer as most handlers read their parameters at fixed offsets
+static uint8_t batchCommand[SPI_MAX_DMA_LEN];
+
+int executeBatch(const uint8_t command[], uint8_t response[])
+{
+  //[0]      CMD_START    < 0xE0    >
+  //[1]      Command      < 1 byte  >
+  //[2]      N args       < 1 byte  >
+  //[3..4]   cmd 1 size   < 2 bytes >
+  //[5]      cmd 1        < n bytes >
+  //         ...          < size and complete command frame for each argument >
+  //
+  // The response has one parameter per sub-command, each one being the
+  // complete (unpadded) response frame of that sub-command with a 2 bytes
+  // length. Sub-commands that return data get what is left of the buffer,
+  // the batch stops at the first sub-command that could not fit, the host
+  // finds how many were run in the number of parameters.
+  BatchReader reader(command, SPI_MAX_DMA_LEN);
+  BatchWriter writer(response, SPI_MAX_DMA_LEN);
+  const uint8_t* subCommand;
+  uint16_t subCommandLength;
+
+  while ((subCommand = reader.next(&subCommandLength)) != NULL) {
+    size_t room;
+    uint8_t* subResponse = writer.reserve(BATCH_RESPONSE_RESERVE, &room);
+    int subResponseLength;
+
+    if (subResponse == NULL) {
+      break;
+    }
+
+    if (subCommandLength < 3 || subCommand[1] == command[1]) {
+      // no nested batches
+      subResponse[0] = 0xef;
+      subResponse[1] = 0x00;
+      subResponse[2] = 0xee;
+      subResponseLength = 3;
+    } else {
+      memcpy(batchCommand, subCommand, subCommandLength);
+      memset(&batchCommand[subCommandLength], 0x00, sizeof(batchCommand) - subCommandLength);
+
+      commandCapacity = subCommandLength;
+      responseCapacity = room;
+      subResponseLength = dispatchCommand(batchCommand, subResponse);
+      commandCapacity = SPI_MAX_DMA_LEN;
+      responseCapacity = SPI_MAX_DMA_LEN;
+    }
+
+    writer.commit(subResponseLength);
+  }
+
+  return writer.finish();
+}
+
+int getSocketsReady(const uint8_t command[], uint8_t response[])
+{
+  uint32_t ready = socketsReady;
+
+  response[2] = 1; // number of parameters
+  response[3] = sizeof(ready); // parameter 1 length
+  memcpy(&response[4], &ready, sizeof(ready));
+
+  return 9;
+}
+
+int flushDataTcp(const uint8_t command[], uint8_t response[])
+{
+  //[0]     CMD_START      < 0xE0    >
+  //[1]     Command        < 1 byte  >
+  //[2]     N args         < 1 byte  >
+  //[3]     socket size    < 1 byte  >
+  //[4]     socket         < 1 byte  >
+  //
+  // Sends what is buffered for the socket, the response is 1 once nothing
+  // is left in the transmit buffer.
+  uint8_t socket = command[4];
+  uint8_t result = 1;
+
+  if (socketTypes[socket] == 0x00 && slotServer(socket) == NULL) {
+    result = txBufferFlush(socket);
+  }
+
+  response[2] = 1; // number of parameters
+  response[3] = 1; // parameter 1 length
+  response[4] = result;
+
+  return 6;
+}
+
+int setTcpCoalescing(const uint8_t command[], uint8_t response[])
+{
+  //[0]     CMD_START      < 0xE0    >
+  //[1]     Command        < 1 byte  >
+  //[2]     N args         < 1 byte  >
+  //[3]     socket size    < 1 byte  >
+  //[4]     socket         < 1 byte  >
+  //[5]     threshold size < 1 byte  >
+  //[6]     threshold      < 2 bytes >
+  //[8]     timeout size   < 1 byte  >
+  //[9]     timeout (ms)   < 2 bytes >
+  //[11]    nodelay size   < 1 byte  >
+  //[12]    nodelay        < 1 byte  >
+  //
+  // Writes are buffered up to threshold bytes (at most TX_BUFFER_SIZE) or
+  // timeout ms after the last one, a threshold of 0 sends them right away.
+  // nodelay sets TCP_NODELAY, disabling Nagle's algorithm on the socket.
+  uint8_t socket = command[4];
+  uint16_t threshold = (command[6] << 8) | command[7];
+  uint16_t timeout = (command[9] << 8) | command[10];
+  int nodelay = command[12];
+
+  response[2] = 1; // number of parameters
+  response[3] = 1; // parameter 1 length
+  response[4] = 0;
+
+  if (socketTypes[socket] != 0x00 || slotServer(socket) != NULL || !tcpClients[socket]) {
+    return 6;
+  }
+
+  if (threshold > TX_BUFFER_SIZE) {
+    threshold = TX_BUFFER_SIZE;
+  }
+
+  if (threshold == 0) {
+    // buffered data the socket doesn't take keeps coalescing on, the host
+    // asks again
+    if (!txBufferStop(socket)) {
+      return 6;
+    }
+  } else {
+    txBufferEnable(socket, threshold, timeout);
+  }
+
+  if (lwip_setsockopt_r(tcpClients[socket].fd(), IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) == 0) {
+    response[4] = 1;
+  }
+
+  return 6;
+}
+
+int getUDPpackets(const uint8_t command[], uint8_t response[])
+{
+  //[0]     CMD_START      < 0xE0    >
+  //[1]     Command        < 1 byte  >
+  //[2]     N args         < 1 byte  >
+  //[3]     socket size    < 1 byte  >
+  //[4]     socket         < 1 byte  >
+  //[5]     max len size   < 1 byte  >
+  //[6]     max len        < 2 bytes >
+  //
+  // Ends the packet being read, dropping it if the host has read from it,
+  // and returns the queued datagrams that fit in max len bytes of
+  // parameters, one parameter each with a 2 byte length: the remote IP
+  // (4 bytes), the remote port (2 bytes) and the data.
+  uint8_t socket = command[4];
+  size_t maxLength = (command[6] << 8) | command[7];
+  int count = 0;
+  int responseLength = 3;
+
+  if (maxLength > (responseCapacity - 4)) {
+    maxLength = (responseCapacity - 4);
+  }
+
+  while (socketTypes[socket] == 0x01 && count < 255) {
+    uint8_t* param = &response[responseLength];
+    /*IPAddress*/uint32_t ip;
+    uint16_t port;
+
+    if ((responseLength - 3 + 2 + 6) >= (int)maxLength) {
+      break;
+    }
+
+    int length = slotUdp(socket)->readDatagram(&param[8], maxLength - (responseLength - 3 + 2 + 6), &ip, &port);
+
+    if (length <= 0) {
+      break;
+    }
+
+    param[0] = ((6 + length) >> 8) & 0xff; // parameter length
+    param[1] = ((6 + length) >> 0) & 0xff;
+    memcpy(&param[2], &ip, sizeof(ip));
+    param[6] = (port >> 8) & 0xff;
+    param[7] = (port >> 0) & 0xff;
+
+    responseLength += (2 + 6 + length);
+    count++;
+  }
+
+  response[2] = count; // number of parameters
+
+  return (responseLength + 1);
+}
+
 int ping(const uint8_t command[], uint8_t response[])
 {
   uint32_t ip;
@@ -1250,6 +2284,20 @@ int getAnalogRead(const uint8_t command[], uint8_t response[])
   return 7;
 }
 
+// readFileBuf() keeps the last file open between chunks, so that sequential
+// reads don't reopen and seek it every time. Anything that modifies the
+// filesystem must close it first.
+static FILE* readCacheFile = NULL;
+static char readCacheFilename[32 + 1];
+static size_t readCacheOffset = 0;
+
+static void closeReadCache() {
+  if (readCacheFile != NULL) {
+    fclose(readCacheFile);
+    readCacheFile = NULL;
+  }
+}
+
 int writeFile(const uint8_t command[], uint8_t response[]) {
   char filename[32 + 1];
   size_t len;
@@ -1261,43 +2309,282 @@ int writeFile(const uint8_t command[], uint8_t response[]) {
   memset(filename, 0x00, sizeof(filename));
   memcpy(filename, &command[6 + command[3] + command[4 + command[3]]], command[5 + command[3] + command[4 + command[3]]]);
 
+  closeReadCache();
+
   FILE* f = fopen(filename, "ab+");
   if (f == NULL) {
     return -1;
   }
 
   fseek(f, offset, SEEK_SET);
-  const uint8_t* data = &command[7 + command[3] + command[4 + command[3]] + command[5 + command[3] + command[4 + command[3]]]];
+  size_t dataOffset = 7 + command[3] + command[4 + command[3]] + command[5 + command[3] + command[4 + command[3]]];
+  const uint8_t* data = &command[dataOffset];
+
+  // the response echoes the length written, so it has to fit as well
+  len = LWIP_MIN(commandDataLength(dataOffset, len), responseCapacity);
+
+  int ret = fwrite(data, 1, len, f);
+  fclose(f);
+
+  // the response is as long as the data written, without parameters
+  if (ret > 2) {
+    memset(&response[2], 0x00, ret - 2);
+  }
+
+  return ret;
+}
+
+int readFile(const uint8_t command[], uint8_t response[]) {
+  char filename[32 + 1];
+  size_t len;
+  size_t offset;
+
+  memcpy(&offset, &command[4], command[3]);
+  memcpy(&len, &command[5 + command[3]], command[4 + command[3]]);
+
+  memset(filename, 0x00, sizeof(filename));
+  memcpy(filename, &command[6 + command[3] + command[4 + command[3]]], command[5 + command[3] + command[4 + command[3]]]);
+
+  if (len > (responseCapacity - 5)) {
+    len = (responseCapacity - 5);
+  }
+
+  FILE* f = fopen(filename, "rb");
+  if (f == NULL) {
+    return -1;
+  }
+  fseek(f, offset, SEEK_SET);
+  size_t read = fread(&response[4], 1, len, f);
+  fclose(f);
+
+  if (read < len) {
+    memset(&response[4 + read], 0x00, len - read);
+  }
+
+  response[2] = 1; // number of parameters
+  response[3] = len; // parameter 1 length
+
+  return len + 5;
+}
+
+int readFileBuf(const uint8_t command[], uint8_t response[]) {
+  char filename[32 + 1];
+  size_t len = 0;
+  size_t offset = 0;
+  uint8_t offsetSize = command[3];
+  uint8_t lenSize = command[4 + offsetSize];
+  uint8_t filenameSize = command[5 + offsetSize + lenSize];
+
+  // values shorter than a size_t leave its high bytes 0
+  memcpy(&offset, &command[4], LWIP_MIN(offsetSize, sizeof(offset)));
+  memcpy(&len, &command[5 + offsetSize], LWIP_MIN(lenSize, sizeof(len)));
+
+  if (filenameSize > (sizeof(filename) - 1)) {
+    return -1;
+  }
+
+  memcpy(filename, &command[6 + offsetSize + lenSize], filenameSize);
+  filename[filenameSize] = '\0';
+
+  if (len > (responseCapacity - 6)) {
+    len = (responseCapacity - 6);
+  }
+
+  if (readCacheFile == NULL || strcmp(filename, readCacheFilename) != 0) {
+    closeReadCache();
+
+    readCacheFile = fopen(filename, "rb");
+    if (readCacheFile == NULL) {
+      return -1;
+    }
+
+    memcpy(readCacheFilename, filename, sizeof(readCacheFilename));
+    readCacheOffset = 0;
+  }
+
+  if (offset != readCacheOffset) {
+    fseek(readCacheFile, offset, SEEK_SET);
+    readCacheOffset = offset;
+  }
+
+  size_t read = fread(&response[5], 1, len, readCacheFile);
+  readCacheOffset += read;
+
+  // a short read is the end of the file
+  response[2] = 1; // number of parameters
+  response[3] = (read >> 8) & 0xff; // parameter 1 length
+  response[4] = (read >> 0) & 0xff;
+
+  return (6 + read);
+}
+
+// Files opened by openFile() stay open until closeFile(), a few SPIFFS file
+// descriptors are left for the commands working on file names. Lengths,
+// offsets and results are little endian, as in readFile() and writeFile().
+#define MAX_FILE_HANDLES (SPIFFS_MAX_FILES - 4)
+
+static FILE* fileHandles[MAX_FILE_HANDLES];
+
+int openFile(const uint8_t command[], uint8_t response[]) {
+  //[0]     CMD_START      < 0xE0   >
+  //[1]     Command        < 1 byte >
+  //[2]     N args         < 1 byte >
+  //[3]     mode size      < 1 byte >
+  //[4]     mode           < 1 byte >
+  //[5]     filename size  < 1 byte >
+  //[6]     filename       < n bytes >
+  static const char* modes[] = { "rb", "wb", "ab", "rb+", "wb+", "ab+" };
+
+  char filename[32 + 1];
+  uint8_t mode = command[4];
+  uint8_t length = command[5];
+  uint8_t handle = 255;
+
+  response[2] = 1; // number of parameters
+  response[3] = 1; // parameter 1 length
+  response[4] = handle;
+
+  if (length > (sizeof(filename) - 1)) {
+    return 6;
+  }
+
+  memcpy(filename, &command[6], length);
+  filename[length] = '\0';
+
+  if (mode < (sizeof(modes) / sizeof(modes[0]))) {
+    for (int i = 0; i < MAX_FILE_HANDLES; i++) {
+      if (fileHandles[i] == NULL) {
+        if (mode != 0) {
+          closeReadCache();
+        }
+
+        fileHandles[i] = fopen(filename, modes[mode]);
+
+        if (fileHandles[i] != NULL) {
+          handle = i;
+        }
+        break;
+      }
+    }
+  }
+
+  response[4] = handle;
+
+  return 6;
+}
+
+int readFileHandle(const uint8_t command[], uint8_t response[]) {
+  //[0]     CMD_START      < 0xE0    >
+  //[1]     Command        < 1 byte  >
+  //[2]     N args         < 1 byte  >
+  //[3]     handle size    < 1 byte  >
+  //[4]     handle         < 1 byte  >
+  //[5]     length size    < 1 byte  >
+  //[6]     length         < 2 bytes, little endian >
+  uint8_t handle = command[4];
+  uint16_t length;
+  size_t read = 0;
+
+  memcpy(&length, &command[6], sizeof(length));
+
+  if (length > (responseCapacity - 6)) {
+    length = (responseCapacity - 6);
+  }
+
+  if (handle < MAX_FILE_HANDLES && fileHandles[handle] != NULL) {
+    read = fread(&response[5], 1, length, fileHandles[handle]);
+  }
+
+  response[2] = 1; // number of parameters
+  response[3] = (read >> 8) & 0xff; // parameter 1 length
+  response[4] = (read >> 0) & 0xff;
+
+  return (6 + read);
+}
+
+int writeFileHandle(const uint8_t command[], uint8_t response[]) {
+  //[0]     CMD_START      < 0xE0    >
+  //[1]     Command        < 1 byte  >
+  //[2]     N args         < 1 byte  >
+  //[3]     handle size    < 2 bytes >
+  //[5]     handle         < 1 byte  >
+  //[6]     data size      < 2 bytes >
+  //[8]     data           < n bytes >
+  //
+  // The parameter sizes are big endian, as in every 16 bit parameter frame,
+  // the response is the number of bytes written, 2 bytes little endian.
+  uint8_t handle = command[5];
+  uint16_t length;
+  uint16_t written = 0;
+
+  memcpy(&length, &command[6], sizeof(length));
+  length = commandDataLength(8, ntohs(length));
+
+  if (handle < MAX_FILE_HANDLES && fileHandles[handle] != NULL) {
+    closeReadCache();
+
+    written = fwrite(&command[8], 1, length, fileHandles[handle]);
+  }
 
-  int ret = fwrite(data, 1, len, f);
-  fclose(f);
+  response[2] = 1; // number of parameters
+  response[3] = sizeof(written); // parameter 1 length
+  memcpy(&response[4], &written, sizeof(written));
 
-  return ret;
+  return 7;
 }
 
-int readFile(const uint8_t command[], uint8_t response[]) {
-  char filename[32 + 1];
-  size_t len;
-  size_t offset;
+int seekFile(const uint8_t command[], uint8_t response[]) {
+  //[0]     CMD_START      < 0xE0    >
+  //[1]     Command        < 1 byte  >
+  //[2]     N args         < 1 byte  >
+  //[3]     handle size    < 1 byte  >
+  //[4]     handle         < 1 byte  >
+  //[5]     offset size    < 1 byte  >
+  //[6]     offset         < 4 bytes, little endian >
+  //[10]    whence size    < 1 byte  >
+  //[11]    whence         < 1 byte  >
+  //
+  // The response is the new position in the file, -1 on error, 4 bytes
+  // little endian.
+  uint8_t handle = command[4];
+  int32_t offset;
+  uint8_t whence = command[11];
+  int32_t position = -1;
+
+  memcpy(&offset, &command[6], sizeof(offset));
+
+  if (handle < MAX_FILE_HANDLES && fileHandles[handle] != NULL && whence <= SEEK_END) {
+    if (fseek(fileHandles[handle], offset, whence) == 0) {
+      position = ftell(fileHandles[handle]);
+    }
+  }
 
-  memcpy(&offset, &command[4], command[3]);
-  memcpy(&len, &command[5 + command[3]], command[4 + command[3]]);
+  response[2] = 1; // number of parameters
+  response[3] = sizeof(position); // parameter 1 length
+  memcpy(&response[4], &position, sizeof(position));
 
-  memset(filename, 0x00, sizeof(filename));
-  memcpy(filename, &command[6 + command[3] + command[4 + command[3]]], command[5 + command[3] + command[4 + command[3]]]);
+  return 9;
+}
 
-  FILE* f = fopen(filename, "rb");
-  if (f == NULL) {
-    return -1;
+int closeFile(const uint8_t command[], uint8_t response[]) {
+  //[0]     CMD_START      < 0xE0   >
+  //[1]     Command        < 1 byte >
+  //[2]     N args         < 1 byte >
+  //[3]     handle size    < 1 byte >
+  //[4]     handle         < 1 byte >
+  uint8_t handle = command[4];
+  int ret = EOF;
+
+  if (handle < MAX_FILE_HANDLES && fileHandles[handle] != NULL) {
+    ret = fclose(fileHandles[handle]);
+    fileHandles[handle] = NULL;
   }
-  fseek(f, offset, SEEK_SET);
-  fread(&response[4], len, 1, f);
-  fclose(f);
 
   response[2] = 1; // number of parameters
-  response[3] = len; // parameter 1 length
+  response[3] = 1; // parameter 1 length
+  response[4] = (ret == 0);
 
-  return len + 5;
+  return 6;
 }
 
 int deleteFile(const uint8_t command[], uint8_t response[]) {
@@ -1311,6 +2598,8 @@ int deleteFile(const uint8_t command[], uint8_t response[]) {
   memset(filename, 0x00, sizeof(filename));
   memcpy(filename, &command[6 + command[3] + command[4 + command[3]]], command[5 + command[3] + command[4 + command[3]]]);
 
+  closeReadCache();
+
   struct stat st;
   if (stat(filename, &st) == 0) {
     // Delete it if it exists
@@ -1325,6 +2614,9 @@ int applyOTA(const uint8_t command[], uint8_t response[]) {
 #ifdef UNO_WIFI_REV2
 
   const char* filename = "/fs/UPDATE.BIN";
+
+  closeReadCache();
+
   FILE* updateFile = fopen(filename, "rb");
 
   // init uart and write update to 4809
@@ -1410,6 +2702,8 @@ int renameFile(const uint8_t command[], uint8_t response[]) {
   memset(new_file_name, 0, sizeof(new_file_name));
   memcpy(new_file_name, &command[5 + command[3]], command[4 + command[3]]);
 
+  closeReadCache();
+
   errno = 0;
   rename(old_file_name, new_file_name);
 
@@ -1439,6 +2733,7 @@ int existsFile(const uint8_t command[], uint8_t response[]) {
   if (ret != 0) {
     st.st_size = -1;
   }
+  memset(&response[4], 0x00, 5);
   memcpy(&response[4], &(st.st_size), sizeof(st.st_size));
 
   response[2] = 1; // number of parameters
@@ -1447,6 +2742,45 @@ int existsFile(const uint8_t command[], uint8_t response[]) {
   return 10;
 }
 
+int crcFile(const uint8_t command[], uint8_t response[]) {
+  //[0]     CMD_START      < 0xE0   >
+  //[1]     Command        < 1 byte >
+  //[2]     N args         < 1 byte >
+  //[3]     filename size  < 1 byte >
+  //[4]     filename       < n bytes >
+  char filename[32 + 1];
+  uint8_t buffer[512];
+  uint8_t length = command[3];
+  size_t read;
+
+  if (length > (sizeof(filename) - 1)) {
+    return -1;
+  }
+
+  memcpy(filename, &command[4], length);
+  filename[length] = '\0';
+
+  FILE* f = fopen(filename, "rb");
+  if (f == NULL) {
+    return -1;
+  }
+
+  uint32_t crc32 = 0xFFFFFFFF;
+
+  while ((read = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+    crc32 = crc_update(crc32, buffer, read);
+  }
+  fclose(f);
+
+  crc32 ^= 0xFFFFFFFF;
+
+  response[2] = 1; // number of parameters
+  response[3] = sizeof(crc32); // parameter 1 length
+  memcpy(&response[4], &crc32, sizeof(crc32));
+
+  return 9;
+}
+
 int downloadFile(const uint8_t command[], uint8_t response[]) {
   char url[64 + 1];
   char filename[64 + 1];
@@ -1458,6 +2792,8 @@ int downloadFile(const uint8_t command[], uint8_t response[]) {
   memcpy(filename, "/fs/", strlen("/fs/"));
   memcpy(&filename[strlen("/fs/")], &command[5 + command[3]], command[4 + command[3]]);
 
+  closeReadCache();
+
   FILE* f = fopen(filename, "w");
   downloadAndSaveFile(url, f, 0);
   fclose(f);
@@ -1465,56 +2801,41 @@ int downloadFile(const uint8_t command[], uint8_t response[]) {
   return 0;
 }
 
-/**
- * Static table used for the table_driven implementation.
- */
-static const uint32_t crc_table[256] = {
-    0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f, 0xe963a535, 0x9e6495a3,
-    0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988, 0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91,
-    0x1db71064, 0x6ab020f2, 0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
-    0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9, 0xfa0f3d63, 0x8d080df5,
-    0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172, 0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b,
-    0x35b5a8fa, 0x42b2986c, 0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
-    0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423, 0xcfba9599, 0xb8bda50f,
-    0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924, 0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d,
-    0x76dc4190, 0x01db7106, 0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
-    0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d, 0x91646c97, 0xe6635c01,
-    0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e, 0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457,
-    0x65b0d9c6, 0x12b7e950, 0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
-    0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7, 0xa4d1c46d, 0xd3d6f4fb,
-    0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0, 0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9,
-    0x5005713c, 0x270241aa, 0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
-    0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81, 0xb7bd5c3b, 0xc0ba6cad,
-    0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a, 0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683,
-    0xe3630b12, 0x94643b84, 0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
-    0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb, 0x196c3671, 0x6e6b06e7,
-    0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc, 0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5,
-    0xd6d6a3e8, 0xa1d1937e, 0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
-    0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55, 0x316e8eef, 0x4669be79,
-    0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236, 0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f,
-    0xc5ba3bbe, 0xb2bd0b28, 0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
-    0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f, 0x72076785, 0x05005713,
-    0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38, 0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21,
-    0x86d3d2d4, 0xf1d4e242, 0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
-    0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69, 0x616bffd3, 0x166ccf45,
-    0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2, 0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db,
-    0xaed16a4a, 0xd9d65adc, 0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
-    0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693, 0x54de5729, 0x23d967bf,
-    0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94, 0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
+struct OTA_Download {
+  union {
+    struct __attribute__((packed)) {
+      uint32_t len;
+      uint32_t crc32;
+    } header;
+    uint8_t buf[sizeof(header)];
+  } ota_header;
+
+  size_t header_size; /* Bytes of the header received so far. */
+  uint32_t ota_size;  /* Bytes of the image received so far. */
+  uint32_t crc32;
 };
 
-uint32_t crc_update(uint32_t crc, const void * data, size_t data_len)
+/* Called for every chunk of the OTA file as it is downloaded: the header is
+ * collected and the CRC of the image computed on the fly, so the file never
+ * has to be read back. */
+static void downloadOTAData(void * arg, const uint8_t * data, size_t len)
 {
-  const unsigned char *d = (const unsigned char *)data;
-  unsigned int tbl_idx;
+  OTA_Download * ota = (OTA_Download *)arg;
+
+  if (ota->header_size < sizeof(ota->ota_header.buf)) {
+    size_t header_len = sizeof(ota->ota_header.buf) - ota->header_size;
+    if (header_len > len) {
+      header_len = len;
+    }
 
-  while (data_len--) {
-    tbl_idx = (crc ^ *d) & 0xff;
-    crc = (crc_table[tbl_idx] ^ (crc >> 8)) & 0xffffffff;
-    d++;
+    memcpy(&ota->ota_header.buf[ota->header_size], data, header_len);
+    ota->header_size += header_len;
+    data += header_len;
+    len -= header_len;
   }
 
-  return crc & 0xffffffff;
+  ota->crc32 = crc_update(ota->crc32, data, len);
+  ota->ota_size += len;
 }
 
 int downloadOTA(const uint8_t command[], uint8_t response[])
@@ -1529,18 +2850,14 @@ int downloadOTA(const uint8_t command[], uint8_t response[])
     ERR_LENGTH   = 2,
     ERR_CRC      = 3,
     ERR_RENAME   = 4,
+    ERR_WRITE    = 5,
+    ERR_DOWNLOAD = 6,
   };
 
-  union {
-    struct __attribute__((packed)) {
-      uint32_t len;
-      uint32_t crc32;
-    } header;
-    uint8_t buf[sizeof(header)];
-  } ota_header;
-
-  int ota_size, c;
-  uint32_t crc32;
+  OTA_Download ota;
+  memset(&ota, 0, sizeof(ota));
+  /* Init CRC */
+  ota.crc32 = 0xFFFFFFFF;
 
   /* Retrieve the URL parameter. */
   char url[128 + 1];
@@ -1553,52 +2870,57 @@ int downloadOTA(const uint8_t command[], uint8_t response[])
   response[3] = 1; /* Length of parameter 1 */
   response[4] = ERR_NO_ERROR; /* The actual payload */
 
-  /* Download the OTA file */
-  FILE * f = fopen(OTA_TEMP_FILE, "w+");
+  closeReadCache();
+
+  /* Download the OTA file, checking it on the way. */
+  FILE * f = fopen(OTA_TEMP_FILE, "w");
   if (!f) {
-    ESP_LOGE(OTA_TAG, "fopen(..., \"w+\") error: %d", ferror(f));
+    ESP_LOGE(OTA_TAG, "fopen(..., \"w\") error: %d", errno);
     response[4] = ERR_OPEN;
     goto ota_cleanup;
   }
-  downloadAndSaveFile(url, f, 0);
+  /* A failed write is reported by the ferror() check below. */
+  if (downloadAndProcessFile(url, f, 0, downloadOTAData, &ota) != 0 && !ferror(f)) {
+    ESP_LOGE(OTA_TAG, "error downloading %s", url);
+    response[4] = ERR_DOWNLOAD;
+    goto ota_cleanup;
+  }
+
+  /* Close the file. The length and CRC checks only see the downloaded
+   * data, so a short write must be caught here. */
+  if (ferror(f)) {
+    ESP_LOGE(OTA_TAG, "error writing %s", OTA_TEMP_FILE);
+    response[4] = ERR_WRITE;
+    goto ota_cleanup;
+  }
+  if (fclose(f) != 0) {
+    f = NULL;
+    ESP_LOGE(OTA_TAG, "fclose(...) error: %d", errno);
+    response[4] = ERR_WRITE;
+    goto ota_cleanup;
+  }
+  f = NULL;
 
-  /* Determine size of downloaded file. */
-  ota_size = ftell(f) - sizeof(ota_header.buf);
-  /* Reposition file pointer at start of file. */
-  rewind(f);
-  /* Read the OTA header. */
-  fread(ota_header.buf, sizeof(ota_header.buf), 1, f);
-  ESP_LOGI(OTA_TAG, "ota image length = %d", ota_header.header.len);
-  ESP_LOGI(OTA_TAG, "ota image crc32 = %X", ota_header.header.crc32);
+  /* Finalise CRC */
+  ota.crc32 ^= 0xFFFFFFFF;
+
+  ESP_LOGI(OTA_TAG, "ota image length = %d", ota.ota_header.header.len);
+  ESP_LOGI(OTA_TAG, "ota image crc32 = %X", ota.ota_header.header.crc32);
 
   /* Check length. */
-  if (ota_header.header.len != ota_size) {
-    ESP_LOGE(OTA_TAG, "error ota length: expected %d, actual %d", ota_header.header.len, ota_size);
+  if (ota.header_size != sizeof(ota.ota_header.buf) || ota.ota_header.header.len != ota.ota_size) {
+    ESP_LOGE(OTA_TAG, "error ota length: expected %d, actual %d", ota.ota_header.header.len, ota.ota_size);
     response[4] = ERR_LENGTH;
     goto ota_cleanup;
   }
 
-  /* Init CRC */
-  crc32 = 0xFFFFFFFF;
-  /* Calculate CRC */
-  c = fgetc(f);
-  while (c != EOF) {
-    crc32 = crc_update(crc32, &c, 1);
-    c = fgetc(f);
-  }
-  /* Finalise CRC */
-  crc32 ^= 0xFFFFFFFF;
-
   /* Check CRC. */
-  if (ota_header.header.crc32 != crc32) {
-    ESP_LOGE(OTA_TAG, "error ota crc: expected %X, actual %X", ota_header.header.crc32, crc32);
+  if (ota.ota_header.header.crc32 != ota.crc32) {
+    ESP_LOGE(OTA_TAG, "error ota crc: expected %X, actual %X", ota.ota_header.header.crc32, ota.crc32);
     response[4] = ERR_CRC;
     goto ota_cleanup;
   }
 
-  /* Close the file. */
-  fclose(f);
-
   /* Rename in case of success. */
   errno = 0;
   rename(OTA_TEMP_FILE, OTA_FILE);
@@ -1611,11 +2933,107 @@ int downloadOTA(const uint8_t command[], uint8_t response[])
   return 6;
 
 ota_cleanup:
-  fclose(f);
+  if (f) {
+    fclose(f);
+  }
   unlink(OTA_TEMP_FILE);
   return 6;
 }
 
+static void expandOTAData(void * arg, const uint8_t * data, size_t len)
+{
+  fwrite(data, 1, len, (FILE *)arg);
+}
+
+int expandOTA(const uint8_t command[], uint8_t response[])
+{
+  static const char * OTA_TAG = "OTA";
+  static const char * OTA_FILE = "/fs/UPDATE.BIN.LZSS";
+  static const char * OTA_BIN_FILE = "/fs/UPDATE.BIN";
+  static const char * OTA_BIN_TEMP_FILE = "/fs/UPDATE.BIN.TMP";
+
+  /* length, crc32, magic number and version precede the compressed image */
+  static const long OTA_HEADER_SIZE = 20;
+
+  int32_t size = -1;
+  uint8_t buffer[256];
+  size_t read;
+  LZSSDecoder * decoder = NULL;
+  FILE * out = NULL;
+
+  closeReadCache();
+
+  FILE * in = fopen(OTA_FILE, "rb");
+  if (!in || fseek(in, OTA_HEADER_SIZE, SEEK_SET) != 0) {
+    ESP_LOGE(OTA_TAG, "can't open %s", OTA_FILE);
+    goto expand_cleanup;
+  }
+
+  out = fopen(OTA_BIN_TEMP_FILE, "w");
+  if (!out) {
+    ESP_LOGE(OTA_TAG, "can't open %s", OTA_BIN_TEMP_FILE);
+    goto expand_cleanup;
+  }
+
+  // exceptions are disabled, a failed new returns NULL
+  decoder = new (std::nothrow) LZSSDecoder(expandOTAData, out);
+  if (!decoder) {
+    ESP_LOGE(OTA_TAG, "can't allocate the decoder");
+    goto expand_cleanup;
+  }
+
+  while ((read = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+    decoder->decode(buffer, read);
+  }
+  decoder->flush();
+
+  if (ferror(in)) {
+    ESP_LOGE(OTA_TAG, "error reading %s", OTA_FILE);
+    goto expand_cleanup;
+  }
+  if (!decoder->complete()) {
+    ESP_LOGE(OTA_TAG, "%s is truncated", OTA_FILE);
+    goto expand_cleanup;
+  }
+  if (ferror(out)) {
+    ESP_LOGE(OTA_TAG, "error writing %s", OTA_BIN_TEMP_FILE);
+    goto expand_cleanup;
+  }
+  if (fclose(out) != 0) {
+    out = NULL;
+    ESP_LOGE(OTA_TAG, "error writing %s", OTA_BIN_TEMP_FILE);
+    goto expand_cleanup;
+  }
+  out = NULL;
+
+  unlink(OTA_BIN_FILE);
+  if (rename(OTA_BIN_TEMP_FILE, OTA_BIN_FILE) != 0) {
+    ESP_LOGE(OTA_TAG, "rename(...) error: %d", errno);
+    goto expand_cleanup;
+  }
+
+  size = decoder->decoded();
+  ESP_LOGI(OTA_TAG, "expanded ota image length = %d", size);
+
+expand_cleanup:
+  if (in) {
+    fclose(in);
+  }
+  if (out) {
+    fclose(out);
+  }
+  if (size < 0) {
+    unlink(OTA_BIN_TEMP_FILE);
+  }
+  delete decoder;
+
+  response[2] = 1; // number of parameters
+  response[3] = sizeof(size); // parameter 1 length
+  memcpy(&response[4], &size, sizeof(size));
+
+  return 9;
+}
+
 //
 // Low-level BSD-like sockets functions
 //
@@ -1791,7 +3209,7 @@ int socket_send(const uint8_t command[], uint8_t response[])
   //[6..7]   buff size  < 2 bytes >
   //[8]      buff       < n bytes >
   uint8_t sock = command[5];
-  uint16_t size = lwip_ntohs(*((uint16_t *) &command[6]));
+  uint16_t size = commandDataLength(8, lwip_ntohs(*((uint16_t *) &command[6])));
 
   errno = 0;
   int16_t ret = lwip_send_r(sock, &command[8], size, 0);
@@ -1815,7 +3233,7 @@ int socket_recv(const uint8_t command[], uint8_t response[])
   //[6..7]   recv       < 2 bytes >
   uint8_t sock = command[4];
   uint16_t size = *((uint16_t *) &command[6]);
-  size = LWIP_MIN(size, (SPI_MAX_DMA_LEN-16));
+  size = LWIP_MIN(size, (responseCapacity-16));
 
   errno = 0;
   int16_t ret = lwip_recv_r(sock, &response[5], size, 0);
@@ -1843,7 +3261,7 @@ int socket_sendto(const uint8_t command[], uint8_t response[])
   uint8_t sock = command[5];
   uint32_t ip = *((uint32_t *) &command[8]);
   uint16_t port = *((uint16_t *) &command[14]);
-  uint16_t size = lwip_ntohs(*((uint16_t *) &command[16]));
+  uint16_t size = commandDataLength(18, lwip_ntohs(*((uint16_t *) &command[16])));
 
   struct sockaddr_in addr;
   memset(&addr, 0x00, sizeof(addr));
@@ -1874,6 +3292,7 @@ int socket_recvfrom(const uint8_t command[], uint8_t response[])
   //[6..7]  recv        < 2 bytes >
   uint8_t sock = command[4];
   uint16_t size = *((uint16_t *) &command[6]);
+  size = LWIP_MIN(size, (responseCapacity-16));
 
   struct sockaddr_in addr;
   socklen_t addr_len = sizeof(addr);
@@ -1949,7 +3368,7 @@ int socket_poll(const uint8_t command[], uint8_t response[])
   fd_set rset, wset, xset;
   FD_ZERO(&rset);
   FD_ZERO(&wset);
-  FD_ZERO(&wset);
+  FD_ZERO(&xset);
 
   FD_SET(sock, &rset);
   FD_SET(sock, &wset);
@@ -1986,6 +3405,119 @@ int socket_poll(const uint8_t command[], uint8_t response[])
   return 6;
 }
 
+// longest wait of socket_poll_many in ms, two ticks at CONFIG_FREERTOS_HZ=100
+#define SOCKET_POLL_MANY_MAX_WAIT 20
+
+int socket_poll_many(const uint8_t command[], uint8_t response[])
+{
+  //[0]     CMD_START      < 0xE0    >
+  //[1]     Command        < 1 byte  >
+  //[2]     N args         < 1 byte  >
+  //[3]     rd mask size   < 1 byte  >
+  //[4]     rd mask        < 2 bytes >
+  //[6]     wr mask size   < 1 byte  >
+  //[7]     wr mask        < 2 bytes >
+  //[9]     timeout size   < 1 byte  >
+  //[10]    timeout (ms)   < 2 bytes >
+  //
+  // Bit n of a mask is socket LWIP_SOCKET_OFFSET + n, errors are reported for
+  // every socket in either mask. The response has the read, write and error
+  // masks of the ready sockets, a failed select reports all of them in error.
+  //
+  // The select runs in the SPI loop, which has to stay free for the other
+  // commands while the network task works, so the wait is cut to
+  // SOCKET_POLL_MANY_MAX_WAIT ms. The 4th parameter of the response is the
+  // part of the timeout that was not waited for because of that, 0 once
+  // a socket is ready or the whole timeout passed: a host waiting longer
+  // sends the command again with it.
+  uint16_t readMask = (command[4] << 8) | command[5];
+  uint16_t writeMask = (command[7] << 8) | command[8];
+  uint16_t timeout = (command[10] << 8) | command[11];
+  uint16_t errorMask = (readMask | writeMask);
+  uint16_t notWaited = 0;
+
+  if (timeout > SOCKET_POLL_MANY_MAX_WAIT) {
+    notWaited = timeout - SOCKET_POLL_MANY_MAX_WAIT;
+    timeout = SOCKET_POLL_MANY_MAX_WAIT;
+  }
+
+  fd_set rset, wset, xset;
+  FD_ZERO(&rset);
+  FD_ZERO(&wset);
+  FD_ZERO(&xset);
+
+  int maxSock = -1;
+
+  for (int i = 0; i < MAX_SOCKETS; i++) {
+    int sock = LWIP_SOCKET_OFFSET + i;
+
+    if (readMask & (1 << i)) {
+      FD_SET(sock, &rset);
+    }
+
+    if (writeMask & (1 << i)) {
+      FD_SET(sock, &wset);
+    }
+
+    if (errorMask & (1 << i)) {
+      FD_SET(sock, &xset);
+      maxSock = sock;
+    }
+  }
+
+  struct timeval tv = {
+    .tv_sec  = timeout / 1000,
+    .tv_usec = (timeout % 1000) * 1000,
+  };
+
+  errno = 0;
+  int ret = lwip_select(maxSock + 1, &rset, &wset, &xset, &tv);
+
+  uint16_t readReady = 0;
+  uint16_t writeReady = 0;
+  uint16_t errorReady = 0;
+
+  if (ret != 0) {
+    notWaited = 0;
+  }
+
+  if (ret == -1) {
+    errorReady = errorMask;
+  } else {
+    for (int i = 0; i < MAX_SOCKETS; i++) {
+      int sock = LWIP_SOCKET_OFFSET + i;
+
+      if ((readMask & (1 << i)) && FD_ISSET(sock, &rset)) {
+        readReady |= (1 << i);
+      }
+
+      if ((writeMask & (1 << i)) && FD_ISSET(sock, &wset)) {
+        writeReady |= (1 << i);
+      }
+
+      if ((errorMask & (1 << i)) && FD_ISSET(sock, &xset)) {
+        errorReady |= (1 << i);
+      }
+    }
+  }
+
+  response[2] = 4; // number of parameters
+  response[3] = 2; // parameter 1 length
+  response[4] = (readReady >> 8) & 0xff;
+  response[5] = (readReady >> 0) & 0xff;
+  response[6] = 2; // parameter 2 length
+  response[7] = (writeReady >> 8) & 0xff;
+  response[8] = (writeReady >> 0) & 0xff;
+  response[9] = 2; // parameter 3 length
+  response[10] = (errorReady >> 8) & 0xff;
+  response[11] = (errorReady >> 0) & 0xff;
+  response[12] = 2; // parameter 4 length
+  response[13] = (notWaited >> 8) & 0xff;
+  response[14] = (notWaited >> 0) & 0xff;
+
+  return 16;
+}
+
 int socket_setsockopt(const uint8_t command[], uint8_t response[])
 {
   //[0]     CMD_START    < 0xE0    >
@@ -2086,13 +3618,13 @@ const CommandHandlerType commandHandlers[] = {
   disconnect, NULL, getIdxRSSI, getIdxEnct, reqHostByName, getHostByName, startScanNetworks, getFwVersion, NULL, sendUDPdata, getRemoteData, getTime, getIdxBSSID, getIdxChannel, ping, getSocket,
 
   // 0x40 -> 0x4f
-  setEnt, NULL, NULL, NULL, sendDataTcp, getDataBufTcp, insertDataBuf, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+  setEnt, NULL, NULL, NULL, sendDataTcp, getDataBufTcp, insertDataBuf, executeBatch, getSocketsReady, socket_poll_many, flushDataTcp, setTcpCoalescing, getUDPpackets, sendUDPpackets, NULL, NULL,
 
   // 0x50 -> 0x5f
   setPinMode, setDigitalWrite, setAnalogWrite, getDigitalRead, getAnalogRead, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
 
   // 0x60 -> 0x6f
-  writeFile, readFile, deleteFile, existsFile, downloadFile,  applyOTA, renameFile, downloadOTA, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+  writeFile, readFile, deleteFile, existsFile, downloadFile,  applyOTA, renameFile, downloadOTA, readFileBuf, openFile, readFileHandle, writeFileHandle, seekFile, closeFile, crcFile, expandOTA,
 
   // Low-level BSD-like sockets functions.
   // 0x70 -> 0x7f
@@ -2115,12 +3647,18 @@ const CommandHandlerType commandHandlers[] = {
 };
 #define NUM_COMMAND_HANDLERS (sizeof(commandHandlers) / sizeof(commandHandlers[0]))
 
-CommandHandlerClass::CommandHandlerClass()
+CommandHandlerClass::CommandHandlerClass() :
+  _wifiReceived(false),
+  _rescanPending(false)
 {
 }
 
 static const int GPIO_IRQ = 0;
 
+// ticks before the sockets are checked again after a receive wake up that
+// found nothing new
+#define GPIO0_RESCAN_DELAY 1
+
 void CommandHandlerClass::begin()
 {
   pinMode(GPIO_IRQ, OUTPUT);
@@ -2130,17 +3668,52 @@ void CommandHandlerClass::begin()
   }
 
   _updateGpio0PinSemaphore = xSemaphoreCreateCounting(2, 0);
+  rxRingsMutex = xSemaphoreCreateMutex();
+  txBuffersMutex = xSemaphoreCreateMutex();
+  socketSlotsMutex = xSemaphoreCreateMutex();
+  connectMutex = xSemaphoreCreateMutex();
+  wifiMutex = xSemaphoreCreateMutex();
 
   WiFi.onReceive(CommandHandlerClass::onWiFiReceive);
   WiFi.onDisconnect(CommandHandlerClass::onWiFiDisconnect);
 
   xTaskCreatePinnedToCore(CommandHandlerClass::gpio0Updater, "gpio0Updater", 8192, NULL, 1, NULL, 1);
+
+  hostByNameCompletion.done = xSemaphoreCreateBinary();
+  scanCompletion.done = xSemaphoreCreateBinary();
+
+  networkJobs = xQueueCreate(MAX_SOCKETS + 2, sizeof(NetworkJob));
+  xTaskCreatePinnedToCore(networkTask, "network", 8192, networkJobs, 1, NULL, 0);
+
+  hostByNameJobs = xQueueCreate(2, sizeof(NetworkJob));
+  xTaskCreatePinnedToCore(networkTask, "hostByName", 4096, hostByNameJobs, 2, NULL, 0);
 }
 
-#define UDIV_UP(a, b) (((a) + (b) - 1) / (b))
-#define ALIGN_UP(a, b) (UDIV_UP(a, b) * (b))
+// set by the commands after which socketsReady can be out of date: those
+// that read data, accept, start or stop sockets. gpio0Updater only checks
+// the sockets again after one of them, for the others the bitmap stays as
+// it is and the receive wake ups keep it current.
+static bool socketsReadyChanged = false;
 
-int CommandHandlerClass::handle(const uint8_t command[], uint8_t response[])
+static bool changesSocketsReady(uint8_t command)
+{
+  switch (command) {
+    case 0x28: // startServerTcp
+    case 0x2b: // availDataTcp
+    case 0x2c: // getDataTcp
+    case 0x2d: // startClientTcp
+    case 0x2e: // stopClientTcp
+    case 0x2f: // getClientStateTcp
+    case 0x45: // getDataBufTcp
+    case 0x4c: // getUDPpackets
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+static int dispatchCommand(const uint8_t command[], uint8_t response[])
 {
   int responseLength = 0;
 
@@ -2150,9 +3723,17 @@ int CommandHandlerClass::handle(const uint8_t command[], uint8_t response[])
     if (commandHandlerType) {
       responseLength = commandHandlerType(command, response);
     }
+
+    if (changesSocketsReady(command[1])) {
+      socketsReadyChanged = true;
+    }
+  }
+
+  if (segmentResponse != NULL) {
+    response = segmentResponse;
   }
 
-  if (responseLength == 0) {
+  if (responseLength <= 0) {
     response[0] = 0xef;
     response[1] = 0x00;
     response[2] = 0xee;
@@ -2164,9 +3745,55 @@ int CommandHandlerClass::handle(const uint8_t command[], uint8_t response[])
     response[responseLength - 1] = 0xee;
   }
 
-  xSemaphoreGive(_updateGpio0PinSemaphore);
+  return responseLength;
+}
+
+int CommandHandlerClass::handle(const uint8_t command[], uint8_t response[])
+{
+  commandResponse = response;
+  segmentResponse = NULL;
+
+  int responseLength = dispatchCommand(command, response);
+
+  if (segmentResponse != NULL) {
+    response = segmentResponse;
+  }
+
+  // handlers only write the bytes they return, the response buffer is not
+  // cleared between commands, so zero the padding up to the aligned length
+  int paddedLength = ALIGN_UP(responseLength, 4);
+
+  memset(&response[responseLength], 0x00, paddedLength - responseLength);
+
+  if (socketsReadyChanged) {
+    socketsReadyChanged = false;
+
+    xSemaphoreGive(_updateGpio0PinSemaphore);
+  }
+
+  return paddedLength;
+}
+
+uint8_t* CommandHandlerClass::responseData()
+{
+  if (segmentResponse != NULL) {
+    return segmentResponse;
+  }
+
+  return commandResponse;
+}
+
+void CommandHandlerClass::responseSent()
+{
+  if (segmentResponse != NULL) {
+    RxRing::release(segmentResponse);
+    segmentResponse = NULL;
+  }
+}
 
-  return ALIGN_UP(responseLength, 4);
+void CommandHandlerClass::updateSocketsReady()
+{
+  xSemaphoreGive(_updateGpio0PinSemaphore);
 }
 
 void CommandHandlerClass::gpio0Updater(void*)
@@ -2178,44 +3805,145 @@ void CommandHandlerClass::gpio0Updater(void*)
 
 void CommandHandlerClass::updateGpio0Pin()
 {
-  xSemaphoreTake(_updateGpio0PinSemaphore, portMAX_DELAY);
+  // also woken up when a transmit buffer has to be sent
+  TickType_t wait = txBuffersFlushExpired();
+
+  if (_rescanPending && wait > GPIO0_RESCAN_DELAY) {
+    wait = GPIO0_RESCAN_DELAY;
+  }
+
+  xSemaphoreTake(_updateGpio0PinSemaphore, wait);
+
+  bool received = _wifiReceived;
+
+  _wifiReceived = false;
+  _rescanPending = false;
+
+  xSemaphoreTake(socketSlotsMutex, portMAX_DELAY);
+
+  // one select() over all open sockets tells which ones have something
+  // queued, only those are then asked for the exact amount of data
+  fd_set readSet;
+  int maxFd = -1;
+  struct timeval timeout = { 0, 0 };
 
-  int available = 0;
+  FD_ZERO(&readSet);
 
   for (int i = 0; i < MAX_SOCKETS; i++) {
+    int fd = -1;
+
     if (socketTypes[i] == 0x00) {
-      if (tcpServers[i] && (tcpServers[i].hasClient() || tcpServers[i].available())) {
-        available = 1;
-        break;
-      } else if (tcpClients[i] && tcpClients[i].connected() && tcpClients[i].available()) {
-        available = 1;
-        break;
+      if (slotServer(i) != NULL) {
+        int serverMaxFd = slotServer(i)->fdSet(&readSet);
+
+        if (serverMaxFd > maxFd) {
+          maxFd = serverMaxFd;
+        }
+      } else if (!rxRings[i].enabled() || rxRings[i].hasRoom()) {
+        // a ring is only read while it has room
+        fd = tcpClients[i].fd();
       }
+    } else if (socketTypes[i] == 0x01 && slotUdp(i) != NULL) {
+      fd = slotUdp(i)->fd();
+    } else if (socketTypes[i] == 0x02 && slotTls(i) != NULL) {
+      fd = slotTls(i)->fd();
+    } else if (socketTypes[i] == 0x04) {
+      fd = bearssl_tcp_client.fd();
     }
 
-    if (socketTypes[i] == 0x01 && udps[i] && (udps[i].available() || udps[i].parsePacket())) {
-      available = 1;
-      break;
+    if (fd != -1) {
+      FD_SET(fd, &readSet);
+
+      if (fd > maxFd) {
+        maxFd = fd;
+      }
     }
+  }
 
-    if (socketTypes[i] == 0x02 && tlsClients[i] && tlsClients[i].connected() && tlsClients[i].available()) {
-      available = 1;
-      break;
+  fd_set requestedSet = readSet;
+
+  if (maxFd == -1) {
+    FD_ZERO(&readSet);
+  } else if (lwip_select(maxFd + 1, &readSet, NULL, NULL, &timeout) < 0) {
+    // one of the sockets was closed under us (e.g. by handleWiFiDisconnect),
+    // check all of them one by one
+    readSet = requestedSet;
+  }
+
+  uint32_t previous = socketsReady;
+  uint32_t ready = 0;
+
+  for (int i = 0; i < MAX_SOCKETS; i++) {
+    uint32_t bit = (1 << i);
+    int available = 0;
+
+    if (socketTypes[i] == 0x00) {
+      if (slotServer(i) != NULL) {
+        available = slotServer(i)->fdIsSet(&readSet);
+      } else if (rxRings[i].enabled()) {
+        if (tcpClients[i] && FD_ISSET(tcpClients[i].fd(), &readSet) && !rxRingFill(i)) {
+          // out of segments, the socket is read directly from now on
+          rxRingDisable(i);
+          available = tcpClients[i].available();
+        } else {
+          available = (rxRings[i].count() > 0);
+        }
+      } else if (tcpClients[i] && FD_ISSET(tcpClients[i].fd(), &readSet)) {
+        // readable with nothing available is a closed connection
+        available = tcpClients[i].available();
+      }
+    } else if (socketTypes[i] == 0x01) {
+      WiFiUDP* udp = slotUdp(i);
+
+      if (udp != NULL && *udp) {
+        // drain the socket into the datagram queue, so bursts don't
+        // overflow lwIP while the host reads the current packet
+        if (FD_ISSET(udp->fd(), &readSet)) {
+          udp->receivePending();
+        }
+
+        // parsePacket() makes the next queued datagram the one being read
+        available = (udp->available() || udp->parsePacket());
+      }
+    } else if (socketTypes[i] == 0x02) {
+      WiFiSSLClient* tls = slotTls(i);
+
+      // decrypted records can stay buffered without the socket being
+      // readable, only a readable socket is worth an mbedTLS read
+      if (tls != NULL && *tls) {
+        if (FD_ISSET(tls->fd(), &readSet)) {
+          available = tls->connected() && tls->available();
+        } else if (previous & bit) {
+          available = tls->buffered();
+        }
+      }
+    } else if (socketTypes[i] == 0x04) {
+      if ((bearssl_tcp_client.fd() != -1 && FD_ISSET(bearssl_tcp_client.fd(), &readSet)) || (previous & bit)) {
+        available = bearsslClient.connected() && bearsslClient.available();
+      }
     }
 
-    if (socketTypes[i] == 0x04 && bearsslClient.connected() && bearsslClient.available()) {
-      available = 1;
-      break;
+    if (available) {
+      ready |= bit;
     }
   }
 
-  if (available) {
+  xSemaphoreGive(socketSlotsMutex);
+
+  // There is no per socket event callback in this IDF, receive wake ups come
+  // from the netif input hook, which can run before lwIP has queued the data
+  // on the socket. When one finds nothing new, check once more shortly after.
+  if (received && (ready & ~previous) == 0) {
+    _rescanPending = true;
+  }
+
+  socketsReady = ready;
+
+  if (ready) {
     digitalWrite(GPIO_IRQ, HIGH);
   } else {
     digitalWrite(GPIO_IRQ, LOW);
   }
-
-  vTaskDelay(1);
 }
 
 void CommandHandlerClass::onWiFiReceive()
@@ -2225,6 +3953,8 @@ void CommandHandlerClass::onWiFiReceive()
 
 void CommandHandlerClass::handleWiFiReceive()
 {
+  _wifiReceived = true;
+
   xSemaphoreGiveFromISR(_updateGpio0PinSemaphore, NULL);
 }
 
@@ -22,6 +22,8 @@
 
 #include <stdint.h>
 
+#define SPIFFS_MAX_FILES 20
+
 class CommandHandlerClass {
 public:
   CommandHandlerClass();
@@ -29,6 +31,13 @@ public:
   void begin();
   int handle(const uint8_t command[], uint8_t response[]);
 
+  // data to send for the last handled command, response[] unless a read was
+  // answered straight from a receive buffer, which responseSent() gives back
+  uint8_t* responseData();
+  void responseSent();
+
+  void updateSocketsReady();
+
 private:
   static void gpio0Updater(void*);
   void updateGpio0Pin();
@@ -41,10 +50,13 @@ private:
 
 private:
   SemaphoreHandle_t _updateGpio0PinSemaphore;
+  volatile bool _wifiReceived;
+  bool _rescanPending;
 };
 
 extern CommandHandlerClass CommandHandler;
 
 extern "C" int downloadAndSaveFile(char * url, FILE * f, const char * cert_pem);
+extern "C" int downloadAndProcessFile(char * url, FILE * f, const char * cert_pem, void (*data_cb)(void * arg, const uint8_t * data, size_t len), void * arg);
 
 #endif
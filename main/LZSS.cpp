@@ -0,0 +1,108 @@
+/*
+  This file is part of the Arduino NINA firmware.
+  Copyright (c) 2018 Arduino SA. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <string.h>
+
+#include "LZSS.h"
+
+LZSSDecoder::LZSSDecoder(OutputCallback output, void* arg) :
+  _output(output),
+  _arg(arg),
+  _r(LZSS_N - LZSS_F),
+  _bits(0),
+  _bitCount(0),
+  _outputLength(0),
+  _decoded(0)
+{
+  memset(_window, ' ', sizeof(_window));
+}
+
+void LZSSDecoder::decode(const uint8_t* data, size_t len)
+{
+  while (1) {
+    // a literal is a 1 bit flag and 8 bits of data, a reference is a 0 bit
+    // flag, an offset and a length: wait until the whole token is there
+    int needed = 1 + LZSS_EI + LZSS_EJ;
+
+    if (_bitCount > 0 && (_bits >> (_bitCount - 1)) & 0x01) {
+      needed = 1 + 8;
+    }
+
+    if (_bitCount < needed) {
+      if (len == 0) {
+        break;
+      }
+
+      _bits = (_bits << 8) | *data++;
+      _bitCount += 8;
+      len--;
+      continue;
+    }
+
+    _bitCount -= needed;
+    uint32_t token = (_bits >> _bitCount) & ((1 << needed) - 1);
+
+    if (needed == (1 + 8)) {
+      uint8_t c = token & 0xff;
+
+      put(c);
+      _window[_r++] = c;
+      _r &= (LZSS_N - 1);
+    } else {
+      int i = (token >> LZSS_EJ) & (LZSS_N - 1);
+      int j = token & ((1 << LZSS_EJ) - 1);
+
+      for (int k = 0; k <= j + 1; k++) {
+        uint8_t c = _window[(i + k) & (LZSS_N - 1)];
+
+        put(c);
+        _window[_r++] = c;
+        _r &= (LZSS_N - 1);
+      }
+    }
+  }
+}
+
+void LZSSDecoder::flush()
+{
+  if (_outputLength) {
+    _output(_arg, _outputBuffer, _outputLength);
+    _outputLength = 0;
+  }
+}
+
+size_t LZSSDecoder::decoded() const
+{
+  return _decoded;
+}
+
+bool LZSSDecoder::complete() const
+{
+  return _bitCount < 8 && (_bits & ((1 << _bitCount) - 1)) == 0;
+}
+
+void LZSSDecoder::put(uint8_t c)
+{
+  _outputBuffer[_outputLength++] = c;
+  _decoded++;
+
+  if (_outputLength == sizeof(_outputBuffer)) {
+    flush();
+  }
+}
@@ -0,0 +1,71 @@
+/*
+  This file is part of the Arduino NINA firmware.
+  Copyright (c) 2018 Arduino SA. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef LZSS_H
+#define LZSS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Streaming decoder for the LZSS format of the Arduino OTA images
+// (11 bit offsets, 4 bit lengths, 2 KB window). Compressed data can be
+// fed in chunks of any size, decoded data is handed to the output
+// callback in chunks of up to LZSS_OUTPUT_LEN bytes.
+
+#define LZSS_EI 11
+#define LZSS_EJ 4
+#define LZSS_N  (1 << LZSS_EI)
+#define LZSS_F  ((1 << LZSS_EJ) + 1)
+
+#define LZSS_OUTPUT_LEN 256
+
+class LZSSDecoder {
+public:
+  typedef void (*OutputCallback)(void* arg, const uint8_t* data, size_t len);
+
+  LZSSDecoder(OutputCallback output, void* arg);
+
+  void decode(const uint8_t* data, size_t len);
+  void flush();
+
+  size_t decoded() const;
+
+  // true if the data fed so far ends on a token boundary, followed by
+  // nothing but the 0 bits padding the last byte
+  bool complete() const;
+
+private:
+  void put(uint8_t c);
+
+private:
+  OutputCallback _output;
+  void* _arg;
+
+  uint8_t _window[LZSS_N];
+  int _r;
+
+  uint32_t _bits;
+  int _bitCount;
+
+  uint8_t _outputBuffer[LZSS_OUTPUT_LEN];
+  size_t _outputLength;
+  size_t _decoded;
+};
+
+#endif
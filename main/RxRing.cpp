@@ -0,0 +1,177 @@
+/*
+  This file is part of the Arduino NINA firmware.
+  Copyright (c) 2018 Arduino SA. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <string.h>
+
+#include <BufferPool.h>
+
+#include "RxRing.h"
+
+static BufferPool segmentPool(RX_SEGMENT_LEN, RX_SEGMENTS, MALLOC_CAP_DMA);
+
+RxRing::RxRing() :
+  _enabled(false),
+  _eof(false),
+  _first(0),
+  _used(0),
+  _count(0)
+{
+  memset(_segments, 0x00, sizeof(_segments));
+}
+
+void RxRing::enable()
+{
+  // data left from the previous connection of the slot
+  disable();
+
+  _enabled = true;
+  _eof = false;
+  _first = 0;
+}
+
+void RxRing::disable()
+{
+  _enabled = false;
+
+  for (int i = 0; i < RX_SEGMENTS; i++) {
+    segmentPool.release(_segments[i].buffer);
+    _segments[i].buffer = NULL;
+  }
+
+  _used = 0;
+  _count = 0;
+}
+
+bool RxRing::hasRoom() const
+{
+  const Segment* last = &_segments[(_first + _used + RX_SEGMENTS - 1) % RX_SEGMENTS];
+
+  if (_eof) {
+    return false;
+  }
+
+  return (_used < RX_SEGMENTS || last->length < RX_SEGMENT_DATA_LEN);
+}
+
+bool RxRing::fill(int fd, RxRingRecv recv)
+{
+  bool allocated = true;
+
+  while (_enabled && fd != -1 && hasRoom()) {
+    Segment* last = segment(_used + RX_SEGMENTS - 1);
+
+    // small reads are appended to the last segment while it has room
+    if (_used == 0 || last->length == RX_SEGMENT_DATA_LEN) {
+      last = segment(_used);
+      last->buffer = (uint8_t*)segmentPool.alloc();
+
+      if (last->buffer == NULL) {
+        // with data queued the next read makes room, otherwise nothing would
+        allocated = (_used > 0);
+        break;
+      }
+
+      last->offset = 0;
+      last->length = 0;
+      _used++;
+    }
+
+    int result = recv(fd, &last->buffer[RX_SEGMENT_HEADER_LEN + last->length], RX_SEGMENT_DATA_LEN - last->length);
+
+    if (result > 0) {
+      last->length += result;
+      _count += result;
+    } else {
+      if (last->length == 0) {
+        segmentPool.release(last->buffer);
+        last->buffer = NULL;
+        _used--;
+      }
+
+      if (result < 0) {
+        _eof = true;
+      }
+      break;
+    }
+  }
+
+  return allocated;
+}
+
+int RxRing::read(uint8_t* buf, size_t len, bool peek)
+{
+  size_t read = 0;
+
+  for (int i = 0; i < _used && read < len; i++) {
+    Segment* s = segment(i);
+    size_t chunk = s->length - s->offset;
+
+    if (chunk > (len - read)) {
+      chunk = (len - read);
+    }
+
+    memcpy(&buf[read], &s->buffer[RX_SEGMENT_HEADER_LEN + s->offset], chunk);
+    read += chunk;
+
+    if (!peek) {
+      s->offset += chunk;
+    }
+  }
+
+  if (!peek) {
+    _count -= read;
+
+    // segments read in full go back to the pool
+    while (_used > 0 && segment(0)->offset == segment(0)->length) {
+      segmentPool.release(segment(0)->buffer);
+      segment(0)->buffer = NULL;
+
+      _first = (_first + 1) % RX_SEGMENTS;
+      _used--;
+    }
+  }
+
+  return read;
+}
+
+uint8_t* RxRing::take(size_t len, size_t* length)
+{
+  uint8_t* buffer = NULL;
+
+  if (_used > 0) {
+    Segment* s = segment(0);
+
+    if (s->offset == 0 && s->length <= len) {
+      buffer = s->buffer;
+      *length = s->length;
+
+      s->buffer = NULL;
+      _first = (_first + 1) % RX_SEGMENTS;
+      _used--;
+      _count -= *length;
+    }
+  }
+
+  return buffer;
+}
+
+void RxRing::release(uint8_t* buffer)
+{
+  segmentPool.release(buffer);
+}
@@ -0,0 +1,104 @@
+/*
+  This file is part of the Arduino NINA firmware.
+  Copyright (c) 2018 Arduino SA. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef RX_RING_H
+#define RX_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sdkconfig.h>
+
+// Receive ring of a TCP client socket. Data is moved into it as soon as the
+// socket becomes readable, the data commands then serve it from memory
+// without any lwIP call. A ring is made of up to RX_SEGMENTS segments of one
+// MSS, by default a full TCP window. Segments are taken from a pool shared by
+// all rings when data arrives and given back once read, so only unread data
+// holds DMA capable memory.
+//
+// A segment keeps room in front of its data for the header of a getDataBufTcp
+// response and behind it for the trailer and padding, so a read asking for at
+// least a whole segment is answered by handing the segment itself to the SPI
+// slave instead of copying its data into the response buffer.
+//
+// The ring does no locking, its users serialize the calls.
+#define RX_SEGMENT_HEADER_LEN 5
+#define RX_SEGMENT_DATA_LEN CONFIG_TCP_MSS
+#define RX_SEGMENT_LEN ((RX_SEGMENT_HEADER_LEN + RX_SEGMENT_DATA_LEN + 1 + 3) & ~3)
+#ifndef RX_SEGMENTS
+#define RX_SEGMENTS ((CONFIG_TCP_WND_DEFAULT + RX_SEGMENT_DATA_LEN - 1) / RX_SEGMENT_DATA_LEN)
+#endif
+
+// reads up to len bytes from the socket without blocking, returns the number
+// of bytes read, 0 when there is nothing to read yet and -1 once the
+// connection is closed or failed
+typedef int (*RxRingRecv)(int fd, uint8_t* buf, size_t len);
+
+class RxRing {
+public:
+  RxRing();
+
+  // drops what is left from a previous connection
+  void enable();
+
+  // gives back all the segments, the ring is no longer filled
+  void disable();
+
+  bool enabled() const { return _enabled; }
+
+  // bytes not read yet
+  size_t count() const { return _count; }
+
+  // data left to read, or the connection still open
+  bool connected() const { return (_count > 0 || !_eof); }
+
+  bool hasRoom() const;
+
+  // reads from the socket until it has nothing more or the ring is full,
+  // returns false if no segment could be allocated while the ring was empty,
+  // the socket then has to be read directly
+  bool fill(int fd, RxRingRecv recv);
+
+  int read(uint8_t* buf, size_t len, bool peek);
+
+  // removes the first segment from the ring and returns its buffer, with the
+  // data at RX_SEGMENT_HEADER_LEN, if it has not been read from and fits in
+  // len, the buffer has to be given back with release()
+  uint8_t* take(size_t len, size_t* length);
+
+  static void release(uint8_t* buffer);
+
+private:
+  struct Segment {
+    uint8_t* buffer; // DMA capable, NULL while the segment is not in use
+    size_t offset;   // next byte to read
+    size_t length;
+  };
+
+  Segment* segment(int index) { return &_segments[(_first + index) % RX_SEGMENTS]; }
+
+  bool _enabled;
+  bool _eof;     // connection closed by the peer or failed
+  Segment _segments[RX_SEGMENTS];
+  int _first;    // segment with the next byte to read
+  int _used;     // segments holding data
+  size_t _count;
+};
+
+#endif
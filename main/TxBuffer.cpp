@@ -0,0 +1,122 @@
+/*
+  This file is part of the Arduino NINA firmware.
+  Copyright (c) 2018 Arduino SA. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <string.h>
+
+#include <BufferPool.h>
+
+#include "TxBuffer.h"
+
+static BufferPool blockPool(TX_BUFFER_SIZE, 1);
+
+TxBuffer::TxBuffer() :
+  _threshold(0),
+  _timeout(0),
+  _data(NULL),
+  _length(0),
+  _lastWrite(0)
+{
+}
+
+void TxBuffer::enable(uint16_t threshold, uint16_t timeout)
+{
+  _threshold = threshold;
+  _timeout = timeout;
+}
+
+void TxBuffer::disable(int socket, TxBufferSend send)
+{
+  flush(socket, send);
+
+  _threshold = 0;
+  _length = 0;
+
+  blockPool.release(_data);
+  _data = NULL;
+}
+
+bool TxBuffer::flush(int socket, TxBufferSend send)
+{
+  if (_length == 0) {
+    return true;
+  }
+
+  size_t written = send(socket, _data, _length);
+
+  memmove(_data, &_data[written], _length - written);
+  _length -= written;
+
+  return (_length == 0);
+}
+
+size_t TxBuffer::write(int socket, TxBufferSend send, const uint8_t* data, size_t len, TickType_t now)
+{
+  size_t written;
+
+  if (_length + len > TX_BUFFER_SIZE) {
+    flush(socket, send);
+  }
+
+  if (_data == NULL && len <= TX_BUFFER_SIZE) {
+    _data = (uint8_t*)blockPool.alloc();
+  }
+
+  if (_length == 0 && (_data == NULL || len > TX_BUFFER_SIZE)) {
+    // too large to be buffered or no block left, nothing is queued in
+    // front of it
+    return send(socket, data, len);
+  }
+
+  // if the flush above left data queued, take what fits
+  written = TX_BUFFER_SIZE - _length;
+  if (written > len) {
+    written = len;
+  }
+
+  memcpy(&_data[_length], data, written);
+  _length += written;
+  _lastWrite = now;
+
+  if (_length >= _threshold) {
+    flush(socket, send);
+  }
+
+  return written;
+}
+
+TickType_t TxBuffer::flushExpired(int socket, TxBufferSend send, TickType_t now)
+{
+  if (_length == 0) {
+    return portMAX_DELAY;
+  }
+
+  TickType_t timeout = pdMS_TO_TICKS(_timeout);
+  TickType_t elapsed = now - _lastWrite;
+
+  if (elapsed >= timeout && !flush(socket, send)) {
+    // the socket send buffer is full, retry on the next tick
+    elapsed = timeout - 1;
+  }
+
+  if (_length == 0) {
+    return portMAX_DELAY;
+  }
+
+  return timeout - elapsed;
+}
@@ -0,0 +1,81 @@
+/*
+  This file is part of the Arduino NINA firmware.
+  Copyright (c) 2018 Arduino SA. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef TX_BUFFER_H
+#define TX_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sdkconfig.h>
+#include <freertos/FreeRTOS.h>
+
+// Transmit buffer of a TCP client socket. Once enabled, writes are collected
+// in one MSS block, taken from a pool shared by all the sockets on the first
+// write, and sent together once the buffer holds threshold bytes or no write
+// came for timeout ms. The block goes back to the pool when the buffer is
+// disabled, which has to happen before the socket is handed to another
+// connection.
+//
+// The buffer does no locking, its users serialize the calls.
+#define TX_BUFFER_SIZE CONFIG_TCP_MSS
+
+// writes up to len bytes to the socket without blocking, returns the number
+// of bytes written
+typedef size_t (*TxBufferSend)(int socket, const uint8_t* buf, size_t len);
+
+class TxBuffer {
+public:
+  TxBuffer();
+
+  // threshold is at most TX_BUFFER_SIZE, 0 disables the buffer
+  void enable(uint16_t threshold, uint16_t timeout);
+
+  // sends what is still buffered, as far as the socket takes it, drops the
+  // rest and gives the block back, writes are sent right away from now on.
+  // Nothing is dropped once flush() returned true, otherwise this is only
+  // for a socket being closed.
+  void disable(int socket, TxBufferSend send);
+
+  bool enabled() const { return (_threshold != 0); }
+
+  // bytes not sent yet
+  size_t length() const { return _length; }
+
+  // returns true when everything was sent, what didn't fit in the socket
+  // send buffer stays for the next flush
+  bool flush(int socket, TxBufferSend send);
+
+  // returns the number of bytes taken, like a short socket write the caller
+  // sends the rest again
+  size_t write(int socket, TxBufferSend send, const uint8_t* data, size_t len, TickType_t now);
+
+  // sends the data once the timeout expired, returns the ticks until it
+  // expires or portMAX_DELAY when nothing is buffered
+  TickType_t flushExpired(int socket, TxBufferSend send, TickType_t now);
+
+private:
+  uint16_t _threshold; // 0 when writes are sent right away
+  uint16_t _timeout;   // in ms
+  uint8_t* _data;
+  size_t _length;
+  TickType_t _lastWrite;
+};
+
+#endif
@@ -6,11 +6,22 @@
 
 #include "esp_http_client.h"
 
-#define MAX_HTTP_RECV_BUFFER 	128
+#define MAX_HTTP_RECV_BUFFER 	1024
 
 static const char* TAG = "HTTP_CLIENT";
 
+typedef void (*download_data_cb_t)(void * arg, const uint8_t * data, size_t len);
+
+int downloadAndProcessFile(char * url, FILE * f, const char * cert_pem, download_data_cb_t data_cb, void * arg);
+
 int downloadAndSaveFile(char * url, FILE * f, const char * cert_pem)
+{
+  return downloadAndProcessFile(url, f, cert_pem, NULL, NULL);
+}
+
+/* Same as downloadAndSaveFile, data_cb is also called with every chunk
+ * received so it can be checked while it is written. */
+int downloadAndProcessFile(char * url, FILE * f, const char * cert_pem, download_data_cb_t data_cb, void * arg)
 {
   char *buffer = (char*)malloc(MAX_HTTP_RECV_BUFFER);
   if (buffer == NULL) {
@@ -31,12 +42,27 @@ int downloadAndSaveFile(char * url, FILE * f, const char * cert_pem)
   }
   int content_length = esp_http_client_fetch_headers(client);
   int total_read_len = 0, read_len;
+  int ret = 0;
+  if (content_length < 0) {
+    ESP_LOGE(TAG, "esp_http_client_fetch_headers failed: %d", content_length);
+    ret = -1;
+  }
   while (total_read_len < content_length) {
     read_len = esp_http_client_read(client, buffer, MAX_HTTP_RECV_BUFFER);
-    fwrite(buffer, sizeof(uint8_t), read_len, f);
     if (read_len <= 0) {
+      /* the connection failed or was closed before the whole file came */
+      ESP_LOGE(TAG, "esp_http_client_read failed after %d of %d bytes", total_read_len, content_length);
+      ret = -1;
+      break;
+    }
+    if (fwrite(buffer, sizeof(uint8_t), read_len, f) != (size_t)read_len) {
+      ESP_LOGE(TAG, "fwrite failed after %d bytes", total_read_len);
+      ret = -1;
       break;
     }
+    if (data_cb) {
+      data_cb(arg, (const uint8_t *)buffer, read_len);
+    }
     total_read_len += read_len;
     ESP_LOGV(TAG, "esp_http_client_read data received: %d, total %d", read_len, total_read_len);
   }
@@ -45,5 +71,5 @@ int downloadAndSaveFile(char * url, FILE * f, const char * cert_pem)
   esp_http_client_cleanup(client);
   free(buffer);	
 
-  return 0;
+  return ret;
 }
\ No newline at end of file
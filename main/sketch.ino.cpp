@@ -42,9 +42,14 @@ extern "C" {
 
 #define SPI_BUFFER_LEN SPI_MAX_DMA_LEN
 
+#define UDIV_UP(a, b) (((a) + (b) - 1) / (b))
+#define ALIGN_UP(a, b) (UDIV_UP(a, b) * (b))
+
 int debug = 0;
 
-uint8_t* commandBuffer;
+uint8_t* commandBuffers[2];
+int commandBufferDirtyLengths[2];
+int commandBufferIndex = 0;
 uint8_t* responseBuffer;
 
 void dumpBuffer(const char* label, uint8_t data[], int length) {
@@ -163,7 +168,7 @@ void setupWiFi() {
   esp_vfs_spiffs_conf_t conf = {
     .base_path = "/fs",
     .partition_label = "storage",
-    .max_files = 20,
+    .max_files = SPIFFS_MAX_FILES,
     .format_if_mount_failed = true
   };
 
@@ -173,32 +178,64 @@ void setupWiFi() {
     while (1); // no shield
   }
 
-  commandBuffer = (uint8_t*)heap_caps_malloc(SPI_BUFFER_LEN, MALLOC_CAP_DMA);
+  commandBuffers[0] = (uint8_t*)heap_caps_malloc(SPI_BUFFER_LEN, MALLOC_CAP_DMA);
+  commandBuffers[1] = (uint8_t*)heap_caps_malloc(SPI_BUFFER_LEN, MALLOC_CAP_DMA);
   responseBuffer = (uint8_t*)heap_caps_malloc(SPI_BUFFER_LEN, MALLOC_CAP_DMA);
 
   CommandHandler.begin();
+
+  // command buffers are only cleared up to their dirty length from now on
+  memset(commandBuffers[0], 0x00, SPI_BUFFER_LEN);
+  memset(commandBuffers[1], 0x00, SPI_BUFFER_LEN);
+  commandBufferDirtyLengths[0] = 0;
+  commandBufferDirtyLengths[1] = 0;
+
+  // arm the receive for the first command
+  SPIS.queue(NULL, commandBuffers[commandBufferIndex], SPI_BUFFER_LEN);
 }
 
 void loop() {
-  // wait for a command
-  memset(commandBuffer, 0x00, SPI_BUFFER_LEN);
-  int commandLength = SPIS.transfer(NULL, commandBuffer, SPI_BUFFER_LEN);
+  uint8_t* commandBuffer = commandBuffers[commandBufferIndex];
+
+  // wait for a command, the receive has already been queued
+  int commandLength = SPIS.wait();
 
   if (commandLength == 0) {
+    SPIS.queue(NULL, commandBuffer, SPI_BUFFER_LEN);
     return;
   }
 
+  // clear what is left of the previous, longer command in this buffer,
+  // the rest of it is still zeroed
+  int* dirtyLength = &commandBufferDirtyLengths[commandBufferIndex];
+
+  if (*dirtyLength > commandLength) {
+    memset(&commandBuffer[commandLength], 0x00, *dirtyLength - commandLength);
+  }
+  *dirtyLength = ALIGN_UP(commandLength, 4);
+
   if (debug) {
     dumpBuffer("COMMAND", commandBuffer, commandLength);
   }
 
-  // process
-  memset(responseBuffer, 0x00, SPI_BUFFER_LEN);
+  // process, the handler takes care of padding the response
   int responseLength = CommandHandler.handle(commandBuffer, responseBuffer);
+  uint8_t* responseData = CommandHandler.responseData();
+
+  // queue the response and, right behind it, the receive for the next
+  // command in the other buffer, so it is armed as soon as the host has
+  // clocked out the response
+  commandBufferIndex ^= 1;
 
-  SPIS.transfer(responseBuffer, NULL, responseLength);
+  SPIS.queue(responseData, NULL, responseLength);
+  SPIS.queue(NULL, commandBuffers[commandBufferIndex], SPI_BUFFER_LEN);
+
+  // wait for the response to be sent
+  SPIS.wait();
 
   if (debug) {
-    dumpBuffer("RESPONSE", responseBuffer, responseLength);
+    dumpBuffer("RESPONSE", responseData, responseLength);
   }
+
+  CommandHandler.responseSent();
 }
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "CRC32.h"
+
+// Compares the CRC32 variants over a multi-MB buffer, as an OTA image is.
+//
+//   make -C test bench
+//
+// crc_update_rom() runs the host stand-in of the ROM function here, its time
+// is only meaningful on the ESP32.
+
+#define DATA_LEN (4 * 1024 * 1024)
+#define ROUNDS   8
+
+static uint32_t byteTable[256];
+
+// classic byte at a time version, for reference
+static uint32_t crcBytewise(uint32_t crc, const void* data, size_t length)
+{
+  const uint8_t* d = (const uint8_t*)data;
+
+  while (length--) {
+    crc = byteTable[(crc ^ *d++) & 0xff] ^ (crc >> 8);
+  }
+
+  return crc;
+}
+
+static double now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(const char* name, uint32_t (*update)(uint32_t, const void*, size_t), const uint8_t* data, int rounds)
+{
+  uint32_t crc = 0;
+  double start = now();
+
+  for (int i = 0; i < rounds; i++) {
+    crc = update(0xffffffff, data, DATA_LEN) ^ 0xffffffff;
+  }
+
+  double seconds = now() - start;
+
+  printf("%-16s %08x %8.1f MB/s\n", name, crc, (double)DATA_LEN * rounds / seconds / (1024 * 1024));
+}
+
+int main()
+{
+  uint8_t* data = (uint8_t*)malloc(DATA_LEN);
+
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+
+    for (int j = 0; j < 8; j++) {
+      crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+
+    byteTable[i] = crc;
+  }
+
+  srand(1);
+  for (size_t i = 0; i < DATA_LEN; i++) {
+    data[i] = rand();
+  }
+
+  printf("%d MB, %d rounds\n", DATA_LEN / (1024 * 1024), ROUNDS);
+
+  bench("bytewise", crcBytewise, data, ROUNDS);
+  bench("slicing-by-8", crc_update, data, ROUNDS);
+  bench("rom (host stub)", crc_update_rom, data, 1);
+
+  free(data);
+
+  return 0;
+}
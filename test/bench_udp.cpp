@@ -0,0 +1,218 @@
+/*
+  This file is part of the Arduino NINA firmware.
+  Copyright (c) 2018 Arduino SA. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <lwip/sockets.h>
+
+#include <WiFi.h>
+#include <WiFiUdp.h>
+
+// CPU time WiFiUDP spends per datagram while its socket keeps receiving
+// bursts of small datagrams, measured on the host against stand-in sockets.
+//
+//   make -C test bench
+//
+// "parsePacket" reads them one per parsePacket() and read(), as the
+// Arduino API does, "getUDPpackets" reads them with readDatagram() as the
+// batch command does. Both run the current WiFiUdp.cpp, the numbers compare
+// the two paths with each other: they leave out the SPI transfers and the
+// lwIP receive, and the ESP32 is slower than the host.
+
+#define DATAGRAM_LEN   64
+#define BURST          WIFI_UDP_QUEUE_LEN
+#define BATCH_LEN      4092
+#define ROUNDS         20000
+
+// heap
+void* heap_caps_malloc(size_t size, uint32_t)
+{
+  return malloc(size);
+}
+
+void heap_caps_free(void* ptr)
+{
+  free(ptr);
+}
+
+// tasks
+void taskYIELD()
+{
+}
+
+// socket, holds the datagrams the peer sent and nobody read yet
+static int pending = 0;
+
+int lwip_socket(int, int, int)
+{
+  return 3;
+}
+
+int lwip_bind(int, const struct sockaddr*, socklen_t)
+{
+  return 0;
+}
+
+int lwip_close_r(int)
+{
+  return 0;
+}
+
+int lwip_ioctl_r(int, long, void*)
+{
+  return 0;
+}
+
+int lwip_setsockopt_r(int, int, int, const void*, socklen_t)
+{
+  return 0;
+}
+
+int lwip_sendto(int, const void*, size_t size, int, const struct sockaddr*, socklen_t)
+{
+  return size;
+}
+
+int lwip_recvfrom_r(int, void* mem, size_t len, int, struct sockaddr* from, socklen_t* fromlen)
+{
+  struct sockaddr_in* addr = (struct sockaddr_in*)from;
+
+  if (pending == 0) {
+    errno = EWOULDBLOCK;
+    return -1;
+  }
+
+  if (len > DATAGRAM_LEN) {
+    len = DATAGRAM_LEN;
+  }
+
+  memset(mem, pending, len);
+  memset(addr, 0x00, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_addr.s_addr = htonl(0xc0a80001);
+  addr->sin_port = htons(4000);
+  *fromlen = sizeof(*addr);
+
+  pending--;
+
+  return len;
+}
+
+// only needed to link beginPacket(const char*)
+WiFiClass::WiFiClass()
+{
+}
+
+int WiFiClass::hostByName(const char*, uint32_t&)
+{
+  return 0;
+}
+
+WiFiClass WiFi;
+
+static double now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int readParsePacket(WiFiUDP& udp)
+{
+  uint8_t buf[DATAGRAM_LEN];
+  int packets = 0;
+
+  while (udp.parsePacket() > 0) {
+    udp.read(buf, sizeof(buf));
+    packets++;
+  }
+
+  return packets;
+}
+
+static int readGetUDPpackets(WiFiUDP& udp)
+{
+  static uint8_t response[BATCH_LEN];
+  int packets = 0;
+  int length;
+
+  do {
+    size_t used = 0;
+    uint32_t ip;
+    uint16_t port;
+
+    // one command, each datagram comes with 8 bytes of length and address
+    length = 0;
+
+    while ((used + 8) < BATCH_LEN) {
+      length = udp.readDatagram(&response[used + 8], BATCH_LEN - used - 8, &ip, &port);
+
+      if (length <= 0) {
+        break;
+      }
+
+      used += 8 + length;
+      packets++;
+    }
+  } while (length > 0);
+
+  return packets;
+}
+
+static void bench(const char* name, int (*drain)(WiFiUDP&))
+{
+  WiFiUDP udp;
+  long packets = 0;
+
+  udp.begin(4000);
+
+  double start = now();
+
+  for (int i = 0; i < ROUNDS; i++) {
+    // a burst arrives, gpio0Updater moves it into the queue and the host
+    // reads it
+    pending = BURST;
+    udp.receivePending();
+
+    packets += drain(udp);
+  }
+
+  double elapsed = now() - start;
+
+  printf("%-14s %8ld packets %8.3f s %8.0f ns/packet\n",
+         name, packets, elapsed, elapsed * 1e9 / packets);
+
+  udp.stop();
+}
+
+int main()
+{
+  printf("%d byte datagrams, bursts of %d\n", DATAGRAM_LEN, BURST);
+
+  bench("parsePacket", readParsePacket);
+  bench("getUDPpackets", readGetUDPpackets);
+
+  return 0;
+}
@@ -0,0 +1,11 @@
+// Host stand-in for the Arduino core header, only the C library part.
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#endif
@@ -0,0 +1,25 @@
+// Host stand-in for the Arduino core interrupt functions, the
+// implementation is provided by the test.
+
+#ifndef _WIRING_INTERRUPTS_
+#define _WIRING_INTERRUPTS_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHANGE  2
+#define FALLING 3
+#define RISING  4
+
+typedef void (*voidFuncPtr)(void);
+
+void attachInterrupt(uint32_t pin, voidFuncPtr callback, uint32_t mode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
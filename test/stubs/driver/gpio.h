@@ -0,0 +1,20 @@
+#ifndef GPIO_H
+#define GPIO_H
+
+#include <esp_err.h>
+
+typedef int gpio_num_t;
+
+typedef enum {
+  GPIO_PULLUP_ONLY,
+  GPIO_PULLDOWN_ONLY,
+  GPIO_PULLUP_PULLDOWN,
+  GPIO_FLOATING,
+} gpio_pull_mode_t;
+
+static inline esp_err_t gpio_set_pull_mode(gpio_num_t, gpio_pull_mode_t)
+{
+  return ESP_OK;
+}
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef SPI_COMMON_H
+#define SPI_COMMON_H
+
+#include <esp_err.h>
+
+typedef enum {
+  SPI_HOST,
+  HSPI_HOST,
+  VSPI_HOST,
+} spi_host_device_t;
+
+typedef void* intr_handle_t;
+
+typedef struct {
+  int mosi_io_num;
+  int miso_io_num;
+  int sclk_io_num;
+  int quadwp_io_num;
+  int quadhd_io_num;
+  int max_transfer_sz;
+  int flags;
+} spi_bus_config_t;
+
+#endif
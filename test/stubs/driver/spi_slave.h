@@ -0,0 +1,37 @@
+// Host stand-in for the ESP-IDF SPI slave driver. The implementation is
+// provided by the test, which plays the part of the hardware and the host.
+
+#ifndef SPI_SLAVE_H
+#define SPI_SLAVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <driver/spi_common.h>
+
+typedef struct {
+  size_t length;
+  size_t trans_len;
+  const void* tx_buffer;
+  void* rx_buffer;
+  void* user;
+} spi_slave_transaction_t;
+
+typedef void (*slave_transaction_cb_t)(spi_slave_transaction_t*);
+
+typedef struct {
+  int spics_io_num;
+  uint32_t flags;
+  int queue_size;
+  uint8_t mode;
+  slave_transaction_cb_t post_setup_cb;
+  slave_transaction_cb_t post_trans_cb;
+} spi_slave_interface_config_t;
+
+esp_err_t spi_slave_initialize(spi_host_device_t host, const spi_bus_config_t* busConfig, const spi_slave_interface_config_t* slaveConfig, int dmaChannel);
+esp_err_t spi_slave_queue_trans(spi_host_device_t host, const spi_slave_transaction_t* trans, TickType_t ticksToWait);
+esp_err_t spi_slave_get_trans_result(spi_host_device_t host, spi_slave_transaction_t** trans, TickType_t ticksToWait);
+
+#endif
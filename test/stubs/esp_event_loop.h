@@ -0,0 +1,28 @@
+// Host stand-in for the IDF event loop and WiFi driver types used by the
+// WiFiClass members.
+
+#ifndef ESP_EVENT_LOOP_H
+#define ESP_EVENT_LOOP_H
+
+#include <stdint.h>
+
+#include <esp_err.h>
+
+typedef int esp_interface_t;
+
+typedef struct {
+  int event_id;
+} system_event_t;
+
+typedef struct {
+  uint8_t bssid[6];
+  uint8_t ssid[33];
+} wifi_ap_record_t;
+
+typedef struct {
+  uint32_t ip;
+  uint32_t netmask;
+  uint32_t gw;
+} tcpip_adapter_ip_info_t;
+
+#endif
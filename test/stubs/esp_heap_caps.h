@@ -0,0 +1,16 @@
+// Host stand-in for the IDF capability based heap, the implementation is
+// provided by the test.
+
+#ifndef ESP_HEAP_CAPS_H
+#define ESP_HEAP_CAPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_DMA  (1 << 3)
+#define MALLOC_CAP_8BIT (1 << 2)
+
+void* heap_caps_malloc(size_t size, uint32_t caps);
+void heap_caps_free(void* ptr);
+
+#endif
@@ -0,0 +1,20 @@
+// Host stand-in for the FreeRTOS types used by the modules under test.
+// Everything runs on a single thread, so nothing here ever blocks.
+
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE  1
+
+#define portMAX_DELAY ((TickType_t)0xffffffff)
+
+// one tick per ms
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+#endif
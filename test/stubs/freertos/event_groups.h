@@ -0,0 +1,11 @@
+// Host stand-in for FreeRTOS event groups, only the handle type.
+
+#ifndef EVENT_GROUPS_H
+#define EVENT_GROUPS_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+typedef void* EventGroupHandle_t;
+
+#endif
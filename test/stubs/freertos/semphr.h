@@ -0,0 +1,78 @@
+// Host stand-in for FreeRTOS semaphores: a counter, taking an empty
+// semaphore fails straight away instead of blocking.
+
+#ifndef SEMPHR_H
+#define SEMPHR_H
+
+#include <freertos/FreeRTOS.h>
+
+struct HostSemaphore {
+  int count;
+  int max;
+};
+
+typedef HostSemaphore* SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t xSemaphoreCreateCounting(int max, int initial)
+{
+  return new HostSemaphore{initial, max};
+}
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+  return xSemaphoreCreateCounting(1, 1);
+}
+
+// the holder can take it again, nobody else ever asks for it
+static inline SemaphoreHandle_t xSemaphoreCreateRecursiveMutex()
+{
+  return xSemaphoreCreateMutex();
+}
+
+static inline BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t semaphore, TickType_t)
+{
+  semaphore->count--;
+
+  return pdTRUE;
+}
+
+static inline BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t semaphore)
+{
+  semaphore->count++;
+
+  return pdTRUE;
+}
+
+static inline void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+  delete semaphore;
+}
+
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t)
+{
+  if (semaphore->count == 0) {
+    return pdFALSE;
+  }
+
+  semaphore->count--;
+
+  return pdTRUE;
+}
+
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+  if (semaphore->count == semaphore->max) {
+    return pdFALSE;
+  }
+
+  semaphore->count++;
+
+  return pdTRUE;
+}
+
+static inline BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t*)
+{
+  return xSemaphoreGive(semaphore);
+}
+
+#endif
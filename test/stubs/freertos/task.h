@@ -0,0 +1,13 @@
+// Host stand-in for the FreeRTOS task functions, the implementation is
+// provided by the test. There is a single thread, vTaskDelay() only has to
+// account for the time a task would sleep.
+
+#ifndef TASK_H
+#define TASK_H
+
+#include <freertos/FreeRTOS.h>
+
+void vTaskDelay(TickType_t ticks);
+void taskYIELD();
+
+#endif
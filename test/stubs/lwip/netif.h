@@ -0,0 +1,15 @@
+// Host stand-in for the lwIP network interface types used by WiFiClass.
+
+#ifndef LWIP_NETIF_H
+#define LWIP_NETIF_H
+
+#include <stdint.h>
+
+typedef int8_t err_t;
+
+struct pbuf;
+struct netif;
+
+typedef err_t (*netif_input_fn)(struct pbuf* p, struct netif* inp);
+
+#endif
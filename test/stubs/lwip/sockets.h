@@ -0,0 +1,23 @@
+// Host stand-in for the lwIP socket API, the address types come from the
+// host headers and the functions are provided by the test.
+
+#ifndef LWIP_SOCKETS_H
+#define LWIP_SOCKETS_H
+
+#include <errno.h>
+#include <stddef.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+int lwip_socket(int domain, int type, int protocol);
+int lwip_bind(int s, const struct sockaddr* name, socklen_t namelen);
+int lwip_close_r(int s);
+int lwip_ioctl_r(int s, long cmd, void* argp);
+int lwip_setsockopt_r(int s, int level, int optname, const void* optval, socklen_t optlen);
+int lwip_sendto(int s, const void* dataptr, size_t size, int flags, const struct sockaddr* to, socklen_t tolen);
+int lwip_recvfrom_r(int s, void* mem, size_t len, int flags, struct sockaddr* from, socklen_t* fromlen);
+
+#endif
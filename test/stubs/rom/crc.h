@@ -0,0 +1,25 @@
+// Host stand-in for the ESP32 ROM CRC functions, with the same convention:
+// crc32_le() inverts the CRC on entry and exit. Computed a bit at a time,
+// its speed says nothing about the ROM version.
+
+#ifndef ROM_CRC_H
+#define ROM_CRC_H
+
+#include <stdint.h>
+
+static inline uint32_t crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len)
+{
+  crc = ~crc;
+
+  while (len--) {
+    crc ^= *buf++;
+
+    for (int i = 0; i < 8; i++) {
+      crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+  }
+
+  return ~crc;
+}
+
+#endif
@@ -0,0 +1,10 @@
+// The values of the project sdkconfig used by the modules under test.
+
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+#define CONFIG_FREERTOS_HZ 100
+#define CONFIG_TCP_MSS 1436
+#define CONFIG_TCP_WND_DEFAULT 5744
+
+#endif
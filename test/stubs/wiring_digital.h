@@ -0,0 +1,28 @@
+// Host stand-in for the Arduino core pin functions, the implementation is
+// provided by the test.
+
+#ifndef WIRING_DIGITAL_H
+#define WIRING_DIGITAL_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOW  0x00
+#define HIGH 0x01
+
+#define INPUT        0x00
+#define OUTPUT       0x01
+#define INPUT_PULLUP 0x02
+
+extern void pinMode(uint32_t pin, uint32_t mode);
+extern void digitalWrite(uint32_t pin, uint32_t val);
+extern int digitalRead(uint32_t pin);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WIRING_DIGITAL_H
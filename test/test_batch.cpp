@@ -0,0 +1,121 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "Batch.h"
+
+static size_t appendFrame(uint8_t* ptr, const uint8_t* frame, uint16_t length)
+{
+  ptr[0] = (length >> 8) & 0xff;
+  ptr[1] = (length >> 0) & 0xff;
+  memcpy(&ptr[2], frame, length);
+
+  return 2 + length;
+}
+
+static void testReader()
+{
+  const uint8_t avail[] = { 0xe0, 0x2b, 0x01, 0x01, 0x03, 0xee };
+  const uint8_t state[] = { 0xe0, 0x2f, 0x01, 0x01, 0x03, 0xee };
+  uint8_t command[64];
+  size_t length = 3;
+
+  command[0] = 0xe0;
+  command[1] = 0x47;
+  command[2] = 2;
+  length += appendFrame(&command[length], avail, sizeof(avail));
+  length += appendFrame(&command[length], state, sizeof(state));
+
+  BatchReader reader(command, length);
+  const uint8_t* frame;
+  uint16_t frameLength;
+
+  frame = reader.next(&frameLength);
+  assert(frame == &command[5]);
+  assert(frameLength == sizeof(avail));
+  assert(memcmp(frame, avail, sizeof(avail)) == 0);
+
+  frame = reader.next(&frameLength);
+  assert(frameLength == sizeof(state));
+  assert(memcmp(frame, state, sizeof(state)) == 0);
+
+  // the count is reached even though the buffer goes on
+  BatchReader counted(command, sizeof(command));
+  assert(counted.next(&frameLength) != NULL);
+  assert(counted.next(&frameLength) != NULL);
+  assert(counted.next(&frameLength) == NULL);
+
+  assert(reader.next(&frameLength) == NULL);
+}
+
+static void testReaderTruncated()
+{
+  const uint8_t avail[] = { 0xe0, 0x2b, 0x01, 0x01, 0x03, 0xee };
+  uint8_t command[64];
+  size_t length = 3;
+  uint16_t frameLength;
+
+  command[0] = 0xe0;
+  command[1] = 0x47;
+  command[2] = 3;
+  length += appendFrame(&command[length], avail, sizeof(avail));
+
+  // second frame claims more bytes than the buffer holds
+  command[length++] = 0x01;
+  command[length++] = 0x00;
+
+  BatchReader reader(command, length + 4);
+  assert(reader.next(&frameLength) != NULL);
+  assert(reader.next(&frameLength) == NULL);
+
+  // not even room for the length of the next frame
+  BatchReader shortReader(command, 3 + 2 + sizeof(avail) + 1);
+  assert(shortReader.next(&frameLength) != NULL);
+  assert(shortReader.next(&frameLength) == NULL);
+}
+
+static void testWriter()
+{
+  uint8_t response[32];
+  size_t room;
+
+  memset(response, 0xaa, sizeof(response));
+
+  BatchWriter writer(response, sizeof(response));
+
+  // 3 header bytes, 2 length bytes and the end byte leave 26
+  uint8_t* sub = writer.reserve(3, &room);
+  assert(sub == &response[5]);
+  assert(room == sizeof(response) - 3 - 2 - 1);
+
+  memset(sub, 0x11, 10);
+  writer.commit(10);
+  assert(response[3] == 0 && response[4] == 10);
+
+  sub = writer.reserve(3, &room);
+  assert(sub == &response[17]);
+  assert(room == sizeof(response) - 15 - 2 - 1);
+
+  // a sub-command needing more than what is left is not started
+  assert(writer.reserve(room + 1, &room) == NULL);
+
+  writer.commit(room);
+
+  assert(writer.reserve(0, &room) == NULL);
+  assert(response[2] == 0xaa);
+
+  int length = writer.finish();
+  assert(response[2] == 2);
+  assert(length == (int)sizeof(response));
+}
+
+int main()
+{
+  testReader();
+  testReaderTruncated();
+  testWriter();
+
+  printf("test_batch: OK\n");
+
+  return 0;
+}
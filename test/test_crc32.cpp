@@ -0,0 +1,73 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CRC32.h"
+
+// bit at a time reference
+static uint32_t crcReference(uint32_t crc, const uint8_t* data, size_t length)
+{
+  while (length--) {
+    crc ^= *data++;
+
+    for (int i = 0; i < 8; i++) {
+      crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+  }
+
+  return crc;
+}
+
+static void testCheckValue()
+{
+  const char* check = "123456789";
+
+  assert((crc_update(0xffffffff, check, strlen(check)) ^ 0xffffffff) == 0xcbf43926);
+  assert(crc_update(0xffffffff, check, 0) == 0xffffffff);
+
+  assert((crc_update_rom(0xffffffff, check, strlen(check)) ^ 0xffffffff) == 0xcbf43926);
+  assert(crc_update_rom(0xffffffff, check, 0) == 0xffffffff);
+}
+
+static void testSplits()
+{
+  uint8_t data[1024 + 8];
+
+  srand(1);
+  for (size_t i = 0; i < sizeof(data); i++) {
+    data[i] = rand();
+  }
+
+  // every start alignment, with lengths below, at and above a slice
+  for (size_t start = 0; start < 8; start++) {
+    for (size_t length = 0; length <= 1024; length += (length < 32) ? 1 : 61) {
+      uint32_t expected = crcReference(0xffffffff, &data[start], length);
+
+      assert(crc_update(0xffffffff, &data[start], length) == expected);
+
+      // the running CRC carries over a split at any position
+      size_t split = length / 3;
+      uint32_t crc = crc_update(0xffffffff, &data[start], split);
+      crc = crc_update(crc, &data[start + split], length - split);
+
+      assert(crc == expected);
+
+      // the ROM version takes a running CRC the same way
+      crc = crc_update_rom(0xffffffff, &data[start], split);
+      crc = crc_update(crc, &data[start + split], length - split);
+
+      assert(crc == expected);
+    }
+  }
+}
+
+int main()
+{
+  testCheckValue();
+  testSplits();
+
+  printf("test_crc32: OK\n");
+
+  return 0;
+}
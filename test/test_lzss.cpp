@@ -0,0 +1,222 @@
+/*
+  This file is part of the Arduino NINA firmware.
+  Copyright (c) 2018 Arduino SA. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "LZSS.h"
+
+// decoded data
+static uint8_t output[4096];
+static size_t outputLength = 0;
+static size_t outputCalls = 0;
+
+static void collect(void* arg, const uint8_t* data, size_t len)
+{
+  assert(arg == output);
+  assert(len > 0 && len <= LZSS_OUTPUT_LEN);
+  assert(outputLength + len <= sizeof(output));
+
+  memcpy(&output[outputLength], data, len);
+  outputLength += len;
+  outputCalls++;
+}
+
+static void resetOutput()
+{
+  outputLength = 0;
+  outputCalls = 0;
+}
+
+// writes tokens most significant bit first, as the OTA image encoder does,
+// the last byte is padded with 0 bits
+class BitWriter {
+public:
+  BitWriter() : _length(0), _bits(0), _bitCount(0) {}
+
+  void literal(uint8_t c)
+  {
+    put(1, 1);
+    put(c, 8);
+  }
+
+  // copies j + 2 bytes from window position i
+  void reference(int i, int j)
+  {
+    put(0, 1);
+    put(i, LZSS_EI);
+    put(j, LZSS_EJ);
+  }
+
+  size_t finish()
+  {
+    if (_bitCount) {
+      _data[_length++] = _bits << (8 - _bitCount);
+      _bitCount = 0;
+    }
+
+    return _length;
+  }
+
+  const uint8_t* data() const { return _data; }
+
+private:
+  void put(uint32_t value, int count)
+  {
+    while (count--) {
+      _bits = (_bits << 1) | ((value >> count) & 0x01);
+
+      if (++_bitCount == 8) {
+        _data[_length++] = _bits;
+        _bits = 0;
+        _bitCount = 0;
+      }
+    }
+  }
+
+  uint8_t _data[4096];
+  size_t _length;
+  uint8_t _bits;
+  int _bitCount;
+};
+
+static bool decode(const uint8_t* data, size_t len, size_t chunk)
+{
+  LZSSDecoder decoder(collect, output);
+
+  resetOutput();
+
+  for (size_t i = 0; i < len; i += chunk) {
+    decoder.decode(&data[i], (len - i) < chunk ? (len - i) : chunk);
+  }
+  decoder.flush();
+
+  assert(decoder.decoded() == outputLength);
+
+  return decoder.complete();
+}
+
+static void testLiterals()
+{
+  // 1 01000001 1 01000001, padded with 0 bits
+  const uint8_t data[] = { 0xa0, 0xd0, 0x40 };
+
+  assert(decode(data, sizeof(data), sizeof(data)));
+
+  assert(outputLength == 2);
+  assert(memcmp(output, "AA", 2) == 0);
+}
+
+static void testStream()
+{
+  // the window starts filled with spaces and is written from N - F on
+  static const char literals[] = "ABCDEFGHIJKLMNOPQRSTUVWXY";
+  static const char expected[] =
+    "  "                        // from the initial spaces
+    "ABCDEFGHIJKLMNOPQRSTUVWXY"
+    "JKLMNOPQRSTUVWXY"          // across the end of the window
+    "YYYYYY";                   // overlapping the bytes it writes
+  BitWriter writer;
+
+  writer.reference(100, 0);
+  for (size_t i = 0; i < strlen(literals); i++) {
+    writer.literal(literals[i]);
+  }
+
+  // the 2 spaces and 'A' to 'O' fill the end of the window, 'P' to 'Y' are
+  // at 0 to 9, so 'J' to 'Y' run across the end and are written at 10 to 25
+  writer.reference(LZSS_N - LZSS_F + 2 + 9, 14);
+
+  // repeats the 'Y' at 25 as it writes it from 26 on
+  writer.reference(25, 4);
+
+  size_t length = writer.finish();
+
+  // whole, in odd chunks and a byte at a time
+  size_t chunks[] = { length, 3, 1 };
+
+  for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+    assert(decode(writer.data(), length, chunks[i]));
+
+    assert(outputLength == strlen(expected));
+    assert(memcmp(output, expected, outputLength) == 0);
+  }
+}
+
+static void testOutputChunks()
+{
+  BitWriter writer;
+  uint8_t expected[3 * LZSS_OUTPUT_LEN + 10];
+
+  for (size_t i = 0; i < sizeof(expected); i++) {
+    expected[i] = i * 13;
+    writer.literal(expected[i]);
+  }
+
+  size_t length = writer.finish();
+
+  assert(decode(writer.data(), length, 100));
+
+  assert(outputLength == sizeof(expected));
+  assert(memcmp(output, expected, sizeof(expected)) == 0);
+  assert(outputCalls == 4);
+}
+
+static void testTruncated()
+{
+  BitWriter writer;
+
+  writer.literal('A');
+  writer.reference(100, 3);
+  writer.literal('B');
+
+  size_t length = writer.finish();
+
+  assert(decode(writer.data(), length, length));
+  assert(outputLength == 1 + 5 + 1);
+
+  // stops inside the literal
+  assert(!decode(writer.data(), length - 1, length));
+  assert(outputLength == 1 + 5);
+
+  // stops inside the reference
+  assert(!decode(writer.data(), 2, length));
+  assert(outputLength == 1);
+
+  // a byte of padding too many
+  uint8_t padded[16];
+
+  memcpy(padded, writer.data(), length);
+  padded[length] = 0x00;
+
+  assert(!decode(padded, length + 1, length + 1));
+}
+
+int main()
+{
+  testLiterals();
+  testStream();
+  testOutputChunks();
+  testTruncated();
+
+  printf("test_lzss: OK\n");
+
+  return 0;
+}
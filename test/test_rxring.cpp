@@ -0,0 +1,269 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RxRing.h"
+
+// heap, can be made to fail
+static bool heapFull = false;
+
+void* heap_caps_malloc(size_t size, uint32_t)
+{
+  if (heapFull) {
+    return NULL;
+  }
+
+  return malloc(size);
+}
+
+void heap_caps_free(void* ptr)
+{
+  free(ptr);
+}
+
+// socket, hands out the stream at most chunk bytes per recv
+#define STREAM_LEN ((RX_SEGMENTS + 1) * RX_SEGMENT_DATA_LEN)
+
+static uint8_t stream[STREAM_LEN];
+static size_t streamQueued = 0; // bytes the peer has sent so far
+static size_t streamRead = 0;
+static size_t streamChunk = STREAM_LEN;
+static bool streamClosed = false;
+
+static int recvStream(int fd, uint8_t* buf, size_t len)
+{
+  assert(fd == 3);
+
+  size_t available = streamQueued - streamRead;
+
+  if (available == 0) {
+    return streamClosed ? -1 : 0;
+  }
+
+  if (len > available) {
+    len = available;
+  }
+  if (len > streamChunk) {
+    len = streamChunk;
+  }
+
+  memcpy(buf, &stream[streamRead], len);
+  streamRead += len;
+
+  return len;
+}
+
+static void resetStream(size_t queued, size_t chunk)
+{
+  for (size_t i = 0; i < STREAM_LEN; i++) {
+    stream[i] = i * 7;
+  }
+
+  streamQueued = queued;
+  streamRead = 0;
+  streamChunk = chunk;
+  streamClosed = false;
+}
+
+static void testTake()
+{
+  RxRing ring;
+  size_t length;
+
+  resetStream(RX_SEGMENT_DATA_LEN + 10, STREAM_LEN);
+  ring.enable();
+
+  assert(ring.fill(3, recvStream));
+  assert(ring.count() == RX_SEGMENT_DATA_LEN + 10);
+
+  // only a whole segment that fits is taken
+  assert(ring.take(RX_SEGMENT_DATA_LEN - 1, &length) == NULL);
+
+  uint8_t* buffer = ring.take(RX_SEGMENT_DATA_LEN, &length);
+
+  assert(buffer != NULL);
+  assert(length == RX_SEGMENT_DATA_LEN);
+  assert(memcmp(&buffer[RX_SEGMENT_HEADER_LEN], stream, length) == 0);
+  assert(ring.count() == 10);
+
+  // the rest of the data is still in order behind it
+  uint8_t data[10];
+
+  assert(ring.read(data, sizeof(data), false) == 10);
+  assert(memcmp(data, &stream[RX_SEGMENT_DATA_LEN], sizeof(data)) == 0);
+  assert(ring.count() == 0);
+
+  RxRing::release(buffer);
+  ring.disable();
+}
+
+static void testPartialRead()
+{
+  RxRing ring;
+
+  // small receives are appended to one segment
+  resetStream(STREAM_LEN, 100);
+  ring.enable();
+
+  assert(ring.fill(3, recvStream));
+  assert(!ring.hasRoom());
+
+  size_t filled = ring.count();
+
+  assert(filled == streamRead);
+  assert(filled == (size_t)RX_SEGMENTS * RX_SEGMENT_DATA_LEN);
+
+  // a peek leaves the data in place
+  uint8_t data[STREAM_LEN];
+
+  assert(ring.read(data, 5, true) == 5);
+  assert(ring.count() == filled);
+
+  // odd sized reads across the segment boundaries
+  size_t read = 0;
+
+  while (read < filled) {
+    int result = ring.read(&data[read], 333, false);
+
+    assert(result > 0);
+    read += result;
+    assert(ring.count() == filled - read);
+  }
+
+  assert(memcmp(data, stream, filled) == 0);
+  assert(ring.read(data, 1, false) == 0);
+
+  // a segment that has been read from is not taken
+  size_t length;
+
+  resetStream(RX_SEGMENT_DATA_LEN, STREAM_LEN);
+  assert(ring.fill(3, recvStream));
+  assert(ring.read(data, 1, false) == 1);
+  assert(ring.take(RX_SEGMENT_DATA_LEN, &length) == NULL);
+
+  ring.disable();
+}
+
+static void testDisable()
+{
+  RxRing ring;
+
+  resetStream(2 * RX_SEGMENT_DATA_LEN, STREAM_LEN);
+  ring.enable();
+
+  assert(ring.fill(3, recvStream));
+  assert(ring.count() > 0);
+
+  ring.disable();
+
+  assert(!ring.enabled());
+  assert(ring.count() == 0);
+
+  // a disabled ring is not filled
+  size_t read = streamRead;
+
+  streamQueued = STREAM_LEN;
+  assert(ring.fill(3, recvStream));
+  assert(streamRead == read);
+  assert(ring.count() == 0);
+}
+
+static void testEof()
+{
+  RxRing ring;
+  uint8_t data[16];
+
+  resetStream(16, STREAM_LEN);
+  streamClosed = true;
+  ring.enable();
+
+  assert(ring.fill(3, recvStream));
+  ring.fill(3, recvStream);
+
+  // still connected until the data has been read
+  assert(!ring.hasRoom());
+  assert(ring.connected());
+  assert(ring.read(data, sizeof(data), false) == 16);
+  assert(!ring.connected());
+
+  ring.disable();
+}
+
+static void testOutOfMemory()
+{
+  RxRing full;
+  RxRing empty;
+  uint8_t data[RX_SEGMENT_DATA_LEN];
+
+  heapFull = true;
+
+  // only the segments cached by the pool are left, use them all up
+  resetStream(STREAM_LEN, RX_SEGMENT_DATA_LEN);
+  full.enable();
+
+  assert(full.fill(3, recvStream));
+  assert(full.count() > 0);
+
+  // a ring with data can wait for it to be read, an empty one can't
+  empty.enable();
+
+  assert(full.fill(3, recvStream));
+  assert(!empty.fill(3, recvStream));
+  assert(empty.count() == 0);
+
+  // a segment read in full is given back and can be used by the other ring
+  assert(full.read(data, sizeof(data), false) == RX_SEGMENT_DATA_LEN);
+  assert(empty.fill(3, recvStream));
+  assert(empty.count() > 0);
+
+  heapFull = false;
+
+  full.disable();
+  empty.disable();
+}
+
+// enabled again for a new connection, a ring gives back what it held
+static void testReenable()
+{
+  RxRing first;
+  RxRing second;
+
+  heapFull = true;
+
+  resetStream(STREAM_LEN, RX_SEGMENT_DATA_LEN);
+  first.enable();
+
+  assert(first.fill(3, recvStream));
+  assert(first.count() == RX_SEGMENTS * RX_SEGMENT_DATA_LEN);
+
+  first.enable();
+
+  assert(first.count() == 0);
+
+  // all the segments are available again
+  resetStream(STREAM_LEN, RX_SEGMENT_DATA_LEN);
+  second.enable();
+
+  assert(second.fill(3, recvStream));
+  assert(second.count() == RX_SEGMENTS * RX_SEGMENT_DATA_LEN);
+
+  heapFull = false;
+
+  first.disable();
+  second.disable();
+}
+
+int main()
+{
+  testTake();
+  testPartialRead();
+  testDisable();
+  testEof();
+  testOutOfMemory();
+  testReenable();
+
+  printf("test_rxring: OK\n");
+
+  return 0;
+}
@@ -0,0 +1,299 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <deque>
+#include <vector>
+
+#include "wiring_digital.h"
+#include "WInterrupts.h"
+
+#include "SPIS.h"
+
+// Simulation of the SPI slave pipeline: the ESP-IDF slave driver is replaced
+// by a model of the hardware that loads one transaction at a time and calls
+// the setup/transfer callbacks like the driver ISR does, the host is a model
+// of the SPI master that only clocks a transaction while READY is LOW.
+// Everything runs on one thread: when the firmware waits for a result the
+// host takes its next step.
+
+#define READY_PIN 33
+#define CS_PIN    5
+
+#define BUFFER_LEN 64
+
+static uint32_t readyLevel = HIGH;
+static std::vector<uint32_t> readyLog;
+static voidFuncPtr csCallback = NULL;
+
+extern "C" void pinMode(uint32_t, uint32_t)
+{
+}
+
+extern "C" void digitalWrite(uint32_t pin, uint32_t val)
+{
+  if (pin == READY_PIN) {
+    readyLevel = val;
+    readyLog.push_back(val);
+  }
+}
+
+extern "C" int digitalRead(uint32_t pin)
+{
+  return (pin == READY_PIN) ? readyLevel : LOW;
+}
+
+extern "C" void attachInterrupt(uint32_t pin, voidFuncPtr callback, uint32_t mode)
+{
+  assert(pin == CS_PIN);
+  assert(mode == FALLING);
+
+  csCallback = callback;
+}
+
+// slave driver model, the front of the pending queue is loaded in the hardware
+static spi_slave_interface_config_t slaveConfig;
+static std::deque<spi_slave_transaction_t*> pending;
+static std::deque<spi_slave_transaction_t*> results;
+static void (*hostStep)() = NULL;
+
+esp_err_t spi_slave_initialize(spi_host_device_t, const spi_bus_config_t*, const spi_slave_interface_config_t* config, int)
+{
+  slaveConfig = *config;
+
+  return ESP_OK;
+}
+
+esp_err_t spi_slave_queue_trans(spi_host_device_t, const spi_slave_transaction_t* trans, TickType_t)
+{
+  spi_slave_transaction_t* t = (spi_slave_transaction_t*)trans;
+
+  // a transaction must not be reused while the driver still owns it
+  for (size_t i = 0; i < pending.size(); i++) {
+    assert(pending[i] != t);
+  }
+  for (size_t i = 0; i < results.size(); i++) {
+    assert(results[i] != t);
+  }
+
+  if ((int)pending.size() == slaveConfig.queue_size) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  pending.push_back(t);
+
+  if (pending.size() == 1) {
+    slaveConfig.post_setup_cb(t);
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t spi_slave_get_trans_result(spi_host_device_t, spi_slave_transaction_t** trans, TickType_t)
+{
+  if (results.empty()) {
+    hostStep();
+  }
+
+  if (results.empty()) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  *trans = results.front();
+  results.pop_front();
+
+  return ESP_OK;
+}
+
+// one transfer clocked by the master, returns the number of bytes exchanged
+static size_t masterTransfer(const uint8_t* mosi, uint8_t* miso, size_t len)
+{
+  // the host only starts a transfer once READY is LOW
+  assert(readyLevel == LOW);
+  assert(!pending.empty());
+
+  csCallback();
+  assert(readyLevel == HIGH);
+
+  spi_slave_transaction_t* trans = pending.front();
+  size_t bytes = trans->length / 8;
+
+  if (bytes > len) {
+    bytes = len;
+  }
+
+  if (trans->rx_buffer && mosi) {
+    memcpy(trans->rx_buffer, mosi, bytes);
+  }
+
+  if (miso) {
+    if (trans->tx_buffer) {
+      memcpy(miso, trans->tx_buffer, bytes);
+    } else {
+      memset(miso, 0x00, bytes);
+    }
+  }
+
+  trans->trans_len = bytes * 8;
+
+  pending.pop_front();
+  slaveConfig.post_trans_cb(trans);
+  results.push_back(trans);
+
+  // the driver loads the next queued transaction straight away
+  if (!pending.empty()) {
+    slaveConfig.post_setup_cb(pending.front());
+  }
+
+  return bytes;
+}
+
+// host model: sends a command, then reads the response
+static int hostCommand = 0;
+static bool hostSendsCommand = true;
+static bool hostSendsEmpty = false;
+static std::vector<int> hostResponses;
+
+static void hostStepCommandResponse()
+{
+  if (hostSendsCommand) {
+    uint8_t command[4] = { 0xe0, (uint8_t)hostCommand, 0x00, 0xee };
+
+    if (hostSendsEmpty) {
+      hostSendsEmpty = false;
+      masterTransfer(command, NULL, 0);
+      return;
+    }
+
+    assert(masterTransfer(command, NULL, sizeof(command)) == sizeof(command));
+    hostSendsCommand = false;
+  } else {
+    uint8_t response[4];
+
+    assert(masterTransfer(NULL, response, sizeof(response)) == sizeof(response));
+    assert(response[0] == 0xe0);
+    assert(response[3] == 0xee);
+
+    hostResponses.push_back(response[1] & 0x7f);
+    hostCommand++;
+    hostSendsCommand = true;
+
+    // the receive for the next command is armed without the firmware
+    assert(readyLevel == LOW);
+    assert(pending.size() == 1);
+    assert(pending.front()->rx_buffer != NULL);
+  }
+}
+
+// firmware side, as in the loop of the sketch
+static uint8_t commandBuffers[2][BUFFER_LEN];
+static int commandBufferIndex = 0;
+static uint8_t responseBuffer[BUFFER_LEN];
+
+static void loop()
+{
+  uint8_t* commandBuffer = commandBuffers[commandBufferIndex];
+
+  int commandLength = SPIS.wait();
+
+  if (commandLength == 0) {
+    SPIS.queue(NULL, commandBuffer, BUFFER_LEN);
+    return;
+  }
+
+  assert(commandLength == 4);
+  assert(commandBuffer[0] == 0xe0);
+  assert(commandBuffer[3] == 0xee);
+
+  responseBuffer[0] = 0xe0;
+  responseBuffer[1] = 0x80 | commandBuffer[1];
+  responseBuffer[2] = 0x00;
+  responseBuffer[3] = 0xee;
+
+  commandBufferIndex ^= 1;
+
+  assert(SPIS.queue(responseBuffer, NULL, 4));
+  // nothing is loaded while the firmware processes, so the response is
+  // armed right away
+  assert(readyLevel == LOW);
+  assert(SPIS.queue(NULL, commandBuffers[commandBufferIndex], BUFFER_LEN));
+
+  assert(SPIS.wait() == 4);
+}
+
+static void testPipeline()
+{
+  hostStep = hostStepCommandResponse;
+
+  SPIS.begin();
+  assert(readyLevel == HIGH);
+
+  SPIS.queue(NULL, commandBuffers[commandBufferIndex], BUFFER_LEN);
+  assert(readyLevel == LOW);
+
+  readyLog.clear();
+
+  for (int i = 0; i < 16; i++) {
+    // a transfer without any data now and then is ignored
+    bool empty = (i % 5 == 3);
+
+    hostSendsEmpty = empty;
+    loop();
+
+    if (empty) {
+      loop();
+    }
+  }
+
+  // every command is answered, in order
+  assert(hostResponses.size() == 16);
+  for (int i = 0; i < 16; i++) {
+    assert(hostResponses[i] == i);
+  }
+
+  // READY goes HIGH on chip select, stays HIGH at the end of the transfer
+  // and LOW again once the next transaction is loaded
+  for (size_t i = 0; i < readyLog.size(); i += 3) {
+    assert(readyLog[i] == HIGH);
+    assert(readyLog[i + 1] == HIGH);
+    assert(readyLog[i + 2] == LOW);
+  }
+
+  assert(pending.size() == 1);
+  assert(results.empty());
+}
+
+// host model for the legacy transfer(): a single command/response exchange
+static void hostStepTransfer()
+{
+  uint8_t data[4] = { 0xe0, 0x01, 0x00, 0xee };
+  uint8_t miso[4];
+
+  masterTransfer(data, miso, sizeof(data));
+  assert(miso[0] == 0xaa);
+}
+
+static void testTransfer()
+{
+  uint8_t out[4] = { 0xaa, 0xbb, 0xcc, 0xdd };
+  uint8_t in[4] = { 0 };
+
+  // the pipeline is left with a receive armed, drop it
+  pending.clear();
+  hostStep = hostStepTransfer;
+
+  assert(SPIS.transfer(out, in, sizeof(in)) == 4);
+  assert(in[1] == 0x01);
+  assert(readyLevel == HIGH);
+  assert(pending.empty());
+}
+
+int main()
+{
+  testPipeline();
+  testTransfer();
+
+  printf("test_spis: OK\n");
+
+  return 0;
+}
@@ -0,0 +1,252 @@
+/*
+  This file is part of the Arduino NINA firmware.
+  Copyright (c) 2018 Arduino SA. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "TxBuffer.h"
+
+// heap, can be made to fail
+static bool heapFull = false;
+
+void* heap_caps_malloc(size_t size, uint32_t)
+{
+  if (heapFull) {
+    return NULL;
+  }
+
+  return malloc(size);
+}
+
+void heap_caps_free(void* ptr)
+{
+  free(ptr);
+}
+
+// socket, takes at most room bytes and records them
+#define SENT_LEN (4 * TX_BUFFER_SIZE)
+
+static uint8_t sent[SENT_LEN];
+static size_t sentLength = 0;
+static size_t sendRoom = SENT_LEN;
+static int sendCalls = 0;
+
+static size_t sendSocket(int socket, const uint8_t* buf, size_t len)
+{
+  assert(socket == 3);
+
+  sendCalls++;
+
+  if (len > sendRoom) {
+    len = sendRoom;
+  }
+
+  memcpy(&sent[sentLength], buf, len);
+  sentLength += len;
+  sendRoom -= len;
+
+  return len;
+}
+
+static void resetSocket(size_t room)
+{
+  sentLength = 0;
+  sendRoom = room;
+  sendCalls = 0;
+}
+
+static void testThreshold()
+{
+  TxBuffer tx;
+  uint8_t data[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+  resetSocket(SENT_LEN);
+  tx.enable(16, 10);
+
+  // collected until threshold bytes are buffered, then sent at once
+  assert(tx.write(3, sendSocket, data, sizeof(data), 0) == sizeof(data));
+  assert(sendCalls == 0);
+  assert(tx.write(3, sendSocket, data, sizeof(data), 1) == sizeof(data));
+  assert(sendCalls == 1);
+  assert(sentLength == 16);
+  assert(memcmp(&sent[8], data, sizeof(data)) == 0);
+  assert(tx.length() == 0);
+
+  tx.disable(3, sendSocket);
+}
+
+static void testTimeout()
+{
+  TxBuffer tx;
+  uint8_t data[4] = { 1, 2, 3, 4 };
+
+  resetSocket(SENT_LEN);
+  tx.enable(TX_BUFFER_SIZE, 10);
+
+  assert(tx.flushExpired(3, sendSocket, 0) == portMAX_DELAY);
+
+  assert(tx.write(3, sendSocket, data, sizeof(data), 100) == sizeof(data));
+  assert(tx.flushExpired(3, sendSocket, 104) == 6);
+  assert(sentLength == 0);
+
+  assert(tx.flushExpired(3, sendSocket, 110) == portMAX_DELAY);
+  assert(sentLength == sizeof(data));
+
+  // a full socket send buffer is retried on the next tick
+  resetSocket(0);
+  assert(tx.write(3, sendSocket, data, sizeof(data), 200) == sizeof(data));
+  assert(tx.flushExpired(3, sendSocket, 210) == 1);
+  assert(tx.length() == sizeof(data));
+
+  sendRoom = SENT_LEN;
+  assert(tx.flushExpired(3, sendSocket, 211) == portMAX_DELAY);
+  assert(sentLength == sizeof(data));
+
+  tx.disable(3, sendSocket);
+}
+
+static void testLargeWrite()
+{
+  TxBuffer tx;
+  static uint8_t data[TX_BUFFER_SIZE + 1];
+
+  resetSocket(SENT_LEN);
+  tx.enable(TX_BUFFER_SIZE, 10);
+
+  // nothing queued in front of it, sent right away
+  assert(tx.write(3, sendSocket, data, sizeof(data), 0) == sizeof(data));
+  assert(sentLength == sizeof(data));
+  assert(tx.length() == 0);
+
+  tx.disable(3, sendSocket);
+}
+
+// turning the buffer off waits until the socket took everything
+static void testStop()
+{
+  TxBuffer tx;
+  uint8_t data[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+  resetSocket(3);
+  tx.enable(16, 10);
+
+  assert(tx.write(3, sendSocket, data, sizeof(data), 0) == sizeof(data));
+
+  // the socket takes part of it, the rest stays buffered
+  assert(!tx.flush(3, sendSocket));
+  assert(tx.enabled());
+  assert(tx.length() == sizeof(data) - 3);
+
+  sendRoom = SENT_LEN;
+  assert(tx.flush(3, sendSocket));
+  tx.disable(3, sendSocket);
+
+  assert(!tx.enabled());
+  assert(sentLength == sizeof(data));
+  assert(memcmp(sent, data, sizeof(data)) == 0);
+}
+
+// the peer closed a socket with data still buffered, the slot is then
+// reused by the next connection
+static void testReopen()
+{
+  TxBuffer tx;
+  TxBuffer other;
+  uint8_t stale[8] = { 0xde, 0xad, 0xbe, 0xef, 0xde, 0xad, 0xbe, 0xef };
+  uint8_t fresh[4] = { 1, 2, 3, 4 };
+
+  resetSocket(0);
+  tx.enable(16, 10);
+
+  assert(tx.write(3, sendSocket, stale, sizeof(stale), 0) == sizeof(stale));
+  assert(tx.write(3, sendSocket, stale, sizeof(stale), 0) == sizeof(stale));
+  assert(tx.length() == 2 * sizeof(stale));
+
+  tx.disable(3, sendSocket);
+
+  assert(!tx.enabled());
+  assert(tx.length() == 0);
+
+  // the block went back to the pool
+  heapFull = true;
+  other.enable(16, 10);
+  assert(other.write(3, sendSocket, fresh, sizeof(fresh), 0) == sizeof(fresh));
+  assert(other.length() == sizeof(fresh));
+  heapFull = false;
+  other.disable(3, sendSocket);
+
+  // the next connection on the slot sends only its own data
+  resetSocket(SENT_LEN);
+  tx.enable(16, 10);
+
+  assert(tx.flushExpired(3, sendSocket, 100) == portMAX_DELAY);
+  assert(tx.flush(3, sendSocket));
+  assert(sentLength == 0);
+
+  assert(tx.write(3, sendSocket, fresh, sizeof(fresh), 200) == sizeof(fresh));
+  assert(tx.flush(3, sendSocket));
+  assert(sentLength == sizeof(fresh));
+  assert(memcmp(sent, fresh, sizeof(fresh)) == 0);
+
+  tx.disable(3, sendSocket);
+}
+
+static void testOutOfMemory()
+{
+  TxBuffer first;
+  TxBuffer second;
+  uint8_t data[4] = { 1, 2, 3, 4 };
+
+  resetSocket(SENT_LEN);
+  heapFull = true;
+
+  // only the block cached by the pool is left, the other buffer writes
+  // straight to its socket
+  first.enable(16, 10);
+  second.enable(16, 10);
+
+  assert(first.write(3, sendSocket, data, sizeof(data), 0) == sizeof(data));
+  assert(first.length() == sizeof(data));
+  assert(sentLength == 0);
+
+  assert(second.write(3, sendSocket, data, sizeof(data), 0) == sizeof(data));
+  assert(second.length() == 0);
+  assert(sentLength == sizeof(data));
+
+  heapFull = false;
+
+  first.disable(3, sendSocket);
+  second.disable(3, sendSocket);
+}
+
+int main()
+{
+  testThreshold();
+  testTimeout();
+  testLargeWrite();
+  testStop();
+  testReopen();
+  testOutOfMemory();
+
+  printf("test_txbuffer: OK\n");
+
+  return 0;
+}
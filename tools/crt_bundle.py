@@ -0,0 +1,131 @@
+#!/usr/bin/env python
+#
+# Converts a PEM file of root certificates into the indexed binary bundle
+# stored in the certs partition, so that the firmware can look up an issuer
+# in place instead of parsing every certificate.
+#
+# Layout, all integers big endian:
+#
+#   magic      "NCB2"
+#   count      2 bytes
+#   index      count x (subject hash 4 bytes, record offset 4 bytes),
+#              sorted by hash
+#   records    subject length 2 bytes, public key length 2 bytes,
+#              not before 7 bytes, not after 7 bytes,
+#              subject (DER Name), public key (DER SubjectPublicKeyInfo)
+#
+# A validity time is the year (2 bytes), month, day, hour, minute and
+# second, in UTC.
+#
+# The subject hash is 32 bit FNV-1a over the DER encoded subject.
+#
+# usage: crt_bundle.py roots.pem roots.bin
+
+import base64
+import struct
+import sys
+
+MAGIC = b"NCB2"
+
+def fnv1a(data):
+	h = 0x811c9dc5
+	for b in bytearray(data):
+		h ^= b
+		h = (h * 0x01000193) & 0xffffffff
+	return h
+
+def der_element(data, offset):
+	# returns (start of the element, end of the element, start of the content)
+	tag_offset = offset
+	offset += 1
+	length = data[offset]
+	offset += 1
+	if length & 0x80:
+		n = length & 0x7f
+		length = 0
+		for i in range(n):
+			length = (length << 8) | data[offset]
+			offset += 1
+	return (tag_offset, offset + length, offset)
+
+def validity_time(data, offset):
+	_, end, start = der_element(data, offset)
+	text = bytes(data[start:end]).decode("ascii").rstrip("Z")
+
+	if data[offset] == 0x17: # UTCTime, YYMMDDHHMMSS
+		year = int(text[0:2])
+		year += 1900 if year >= 50 else 2000
+		text = text[2:]
+	else: # GeneralizedTime, YYYYMMDDHHMMSS
+		year = int(text[0:4])
+		text = text[4:]
+
+	fields = [int(text[i:i + 2]) for i in range(0, 10, 2)]
+
+	return (struct.pack(">H5B", year, *fields), end)
+
+def subject_key_and_validity(der):
+	data = bytearray(der)
+
+	# Certificate ::= SEQUENCE { tbsCertificate, ... }
+	_, _, offset = der_element(data, 0)
+	# TBSCertificate ::= SEQUENCE { [0] version OPTIONAL, serialNumber,
+	#   signature, issuer, validity, subject, subjectPublicKeyInfo, ... }
+	_, _, offset = der_element(data, offset)
+
+	if data[offset] == 0xa0:
+		_, offset, _ = der_element(data, offset)
+
+	for i in range(3): # serialNumber, signature, issuer
+		_, offset, _ = der_element(data, offset)
+
+	# Validity ::= SEQUENCE { notBefore Time, notAfter Time }
+	_, validity_end, offset = der_element(data, offset)
+	not_before, offset = validity_time(data, offset)
+	not_after, offset = validity_time(data, offset)
+
+	subject_start, subject_end, _ = der_element(data, validity_end)
+	key_start, key_end, _ = der_element(data, subject_end)
+
+	return (bytes(data[subject_start:subject_end]), bytes(data[key_start:key_end]), not_before + not_after)
+
+def pem_certificates(pem):
+	certs = []
+	lines = None
+
+	for line in pem.decode("ascii").splitlines():
+		line = line.strip()
+		if line == "-----BEGIN CERTIFICATE-----":
+			lines = []
+		elif line == "-----END CERTIFICATE-----":
+			certs.append(base64.b64decode("".join(lines)))
+			lines = None
+		elif lines is not None:
+			lines.append(line)
+
+	return certs
+
+def create_bundle(pem):
+	entries = []
+
+	for der in pem_certificates(pem):
+		subject, key, validity = subject_key_and_validity(der)
+		entries.append((fnv1a(subject), subject, key, validity))
+
+	entries.sort(key=lambda entry: entry[0])
+
+	index = bytearray()
+	records = bytearray()
+	offset = len(MAGIC) + 2 + 8 * len(entries)
+
+	for h, subject, key, validity in entries:
+		index += struct.pack(">II", h, offset + len(records))
+		records += struct.pack(">HH", len(subject), len(key)) + validity + subject + key
+
+	return bytes(MAGIC + struct.pack(">H", len(entries)) + index + records)
+
+if __name__ == "__main__":
+	pem = open(sys.argv[1], "rb").read()
+
+	with open(sys.argv[2], "wb") as f:
+		f.write(create_bundle(pem))